@@ -0,0 +1,514 @@
+#define _GNU_SOURCE
+
+#include "appender.h"
+#include "ioutil.h"
+#include "request.h"
+#include "store.h"
+#include "util.h"
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// tracks APPENDs that stream their body straight into the target object
+// instead of staging it in a tmpfile. an object has at most one in-place
+// writer (the owner of its slot), which writes past the published length
+// of the object at base. readers clamp the object to base, and its mtime
+// to the one it had when the slot was claimed, until the owner publishes
+// its bytes by dropping the slot on commit.
+//
+// any other commit to the object must first demote the owner: its bytes so
+// far are copied into a tmpfile that is dup2()'d over the owner's
+// descriptor, and the object is truncated back to base, after which the
+// owner carries on as a staged APPEND without noticing. the owner holds the
+// slot lock whenever it is being serviced, so demotion only ever happens
+// while it is suspended or queued, and a stalled client can never hold up
+// the commits of other requests.
+//
+// the bytes of an owner are in the object before they are published, so
+// every claim first records the published length and mtime of the object
+// in a journal, in a record of its own at the owner's descriptor number,
+// and the record is cleared once the object is back to a published state.
+// at startup appender_recover() truncates the objects that still have a
+// record, which removes the bytes of APPENDs that a crash interrupted
+
+#define APPEND_JOURNAL "append-journal"
+
+typedef struct {
+    int64_t base;
+    struct timespec mtime;
+    char name[NAME_MAX + 1]; // empty for a cleared record
+} intent_t;
+
+struct appendslot_t {
+    appender_t *ap;
+    appendslot_t *next;
+    char *name;
+    int fd;
+    off_t base;
+    struct timespec mtime; // mtime of the object when the slot was claimed
+    int refs;
+    bool demoted;
+    bool removed; // the owner published or aborted, fd may be closed
+    pthread_mutex_t lock;
+};
+
+struct appender_t {
+    appendslot_t **buckets;
+    size_t nbuckets;
+    int journal;
+    bool sync; // whether records reach the disk before the object does
+    pthread_mutex_t lock;
+};
+
+static appendslot_t **appender_bucket(appender_t *ap, char *name) {
+    return &ap->buckets[strhash(name) % ap->nbuckets];
+}
+
+// finds the slot of an object, the caller must hold the appender lock
+//
+static appendslot_t *appender_find(appender_t *ap, char *name) {
+    appendslot_t *slot = *appender_bucket(ap, name);
+
+    while (slot != NULL && strcmp(slot->name, name) != 0) {
+        slot = slot->next;
+    }
+
+    return slot;
+}
+
+// unlinks a slot from its bucket, the caller must hold the appender lock
+//
+static void appender_remove(appender_t *ap, appendslot_t *slot) {
+    appendslot_t **link = appender_bucket(ap, slot->name);
+
+    while (*link != slot) {
+        link = &(*link)->next;
+    }
+
+    *link = slot->next;
+    slot->refs--;
+}
+
+static void appendslot_destroy(appendslot_t *slot) {
+    pthread_mutex_destroy(&slot->lock);
+    free(slot->name);
+    free(slot);
+}
+
+// drops a reference to a slot and frees it with the last one
+//
+static void appendslot_unref(appendslot_t *slot) {
+    appender_t *ap = slot->ap;
+    bool last;
+
+    pthread_mutex_lock(&ap->lock);
+    last = --slot->refs == 0;
+    pthread_mutex_unlock(&ap->lock);
+
+    if (last) {
+        appendslot_destroy(slot);
+    }
+}
+
+// truncates the object back to its published length and restores the
+// mtime it was claimed with, undoing the owner's writes. returns 0 on
+// success and -1 on failure
+//
+static int appendslot_truncate(appendslot_t *slot) {
+    struct timespec times[2] = { { .tv_nsec = UTIME_OMIT }, slot->mtime };
+
+    if (ftruncate(slot->fd, slot->base) < 0 || futimens(slot->fd, times) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// writes the journal record of a slot, or clears it if intent is NULL.
+// returns 0 on success and -1 on failure
+//
+static int appendslot_record(appendslot_t *slot, intent_t *intent) {
+    appender_t *ap = slot->ap;
+    intent_t cleared = { 0 };
+    off_t off = (off_t) slot->fd * sizeof(intent_t);
+
+    if (intent == NULL) {
+        intent = &cleared;
+    }
+
+    if (pwrite(ap->journal, intent, sizeof(intent_t), off) != sizeof(intent_t)
+        || (ap->sync && fdatasync(ap->journal) < 0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// looks up the slot of an object and takes a reference to it
+//
+static appendslot_t *appender_get(appender_t *ap, char *name) {
+    appendslot_t *slot;
+
+    pthread_mutex_lock(&ap->lock);
+    slot = appender_find(ap, name);
+    if (slot != NULL) {
+        slot->refs++;
+    }
+    pthread_mutex_unlock(&ap->lock);
+
+    return slot;
+}
+
+// truncates the objects of the APPENDs that were still in place when the
+// server last stopped back to the length and mtime they had before, then
+// empties the journal. must run before any request is served, whether or
+// not in-place APPENDs are on this time. returns 0 on success, or -1 if an
+// object could not be recovered
+//
+// store: store the objects are in
+//
+int appender_recover(store_t *store) {
+    struct timespec times[2] = { { .tv_nsec = UTIME_OMIT } };
+    status_t status = OK;
+    struct stat statbuf;
+    intent_t intent;
+    off_t off = 0;
+    int journal, fd, rc = 0;
+
+    journal = open(APPEND_JOURNAL, O_RDWR);
+    if (journal < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    for (; pread(journal, &intent, sizeof intent, off) == sizeof intent; off += sizeof intent) {
+        if (intent.name[0] == '\0') {
+            continue;
+        }
+
+        intent.name[NAME_MAX] = '\0';
+        fd = store_openw(store, intent.name, &status);
+        if (fd < 0) {
+            continue; // the object was removed
+        }
+
+        times[1] = intent.mtime;
+        if (fstat(fd, &statbuf) < 0
+            || (statbuf.st_size > intent.base
+                && (ftruncate(fd, intent.base) < 0 || futimens(fd, times) < 0))
+            || store_refresh(store, intent.name) < 0) {
+            warn("failed to recover %s from an interrupted APPEND", intent.name);
+            rc = -1;
+        } else if (statbuf.st_size > intent.base) {
+            warnx("dropped the unpublished bytes of an APPEND to %s", intent.name);
+        }
+
+        close(fd);
+    }
+
+    if (rc == 0 && (ftruncate(journal, 0) < 0 || fsync(journal) < 0)) {
+        rc = -1;
+    }
+
+    close(journal);
+    return rc;
+}
+
+// creates the appender and its empty journal
+//
+// nbuckets: number of buckets of the slot table
+// sync    : whether journal records are synced as they are written, which
+//           durable writes need
+//
+appender_t *appender_create(size_t nbuckets, bool sync) {
+    appender_t *ap = (appender_t *) malloc(sizeof(appender_t));
+    if (ap == NULL) {
+        return NULL;
+    }
+
+    ap->buckets = (appendslot_t **) calloc(nbuckets, sizeof(appendslot_t *));
+    if (ap->buckets == NULL) {
+        free(ap);
+        return NULL;
+    }
+
+    ap->journal = open(APPEND_JOURNAL, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (ap->journal < 0) {
+        free(ap->buckets);
+        free(ap);
+        return NULL;
+    }
+
+    ap->nbuckets = nbuckets;
+    ap->sync = sync;
+    ap->lock = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    return ap;
+}
+
+// frees the appender. the requests owning slots must have been destroyed
+// before this
+//
+void appender_destroy(appender_t **ap) {
+    if (ap && *ap) {
+        close((*ap)->journal);
+        pthread_mutex_destroy(&(*ap)->lock);
+        free((*ap)->buckets);
+        free(*ap);
+        *ap = NULL;
+    }
+}
+
+// makes the caller the in-place writer of an object, unless the object
+// already has one or its journal record cannot be written. returns the
+// slot with its lock held by the caller, or NULL if the APPEND has to be
+// staged. the caller must hold the object's write lock so that base is the
+// published length of the object
+//
+// ap     : appender
+// name   : object name
+// fd     : descriptor of the object opened for reading and writing, which
+//          the owner writes its body through
+// statbuf: the object's metadata, its size is the published length
+//
+appendslot_t *appender_claim(appender_t *ap, char *name, int fd, struct stat *statbuf) {
+    intent_t intent = { .base = statbuf->st_size, .mtime = statbuf->st_mtim };
+    appendslot_t *slot;
+
+    if (strlen(name) > NAME_MAX) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ap->lock);
+    if (appender_find(ap, name) != NULL) {
+        pthread_mutex_unlock(&ap->lock);
+        return NULL;
+    }
+
+    slot = (appendslot_t *) calloc(1, sizeof(appendslot_t));
+    if (slot == NULL || (slot->name = strdup(name)) == NULL) {
+        pthread_mutex_unlock(&ap->lock);
+        free(slot);
+        return NULL;
+    }
+
+    slot->ap = ap;
+    slot->fd = fd;
+    slot->base = statbuf->st_size;
+    slot->mtime = statbuf->st_mtim;
+    slot->refs = 2; // one for the table, one for the owner
+    slot->lock = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&slot->lock);
+
+    slot->next = *appender_bucket(ap, name);
+    *appender_bucket(ap, name) = slot;
+    pthread_mutex_unlock(&ap->lock);
+
+    // nothing has been written past base yet, so readers that clamp to
+    // the slot before its record is written are not misled
+    strcpy(intent.name, name);
+    if (appendslot_record(slot, &intent) < 0) {
+        pthread_mutex_lock(&ap->lock);
+        appender_remove(ap, slot);
+        pthread_mutex_unlock(&ap->lock);
+        pthread_mutex_unlock(&slot->lock);
+        appendslot_unref(slot);
+        return NULL;
+    }
+
+    return slot;
+}
+
+// clamps the metadata of an object to its published length and mtime,
+// hiding the bytes of an in-place APPEND that has not committed yet. the
+// mtime only advances once they are published, so they never change the
+// object's validators either
+//
+// ap     : appender
+// name   : object name
+// statbuf: the object's metadata, updated in place
+//
+void appender_clamp(appender_t *ap, char *name, struct stat *statbuf) {
+    appendslot_t *slot;
+
+    pthread_mutex_lock(&ap->lock);
+    slot = appender_find(ap, name);
+    if (slot != NULL) {
+        if (slot->base < statbuf->st_size) {
+            statbuf->st_size = slot->base;
+        }
+        statbuf->st_mtim = slot->mtime;
+    }
+    pthread_mutex_unlock(&ap->lock);
+}
+
+// turns the in-place writer of an object into a staged APPEND so that the
+// caller can commit to the object. the caller must hold the object's write
+// lock. returns 1 if the object has no in-place writer anymore, 0 if the
+// writer is being serviced right now and the caller must release the
+// object lock and appender_wait() before trying again, and -1 if the
+// writer's bytes could not be moved out of the object
+//
+// ap  : appender
+// name: object name
+//
+int appender_demote(appender_t *ap, char *name) {
+    char tmpname[TMPSIZE];
+    status_t status = OK;
+    off_t pos, off;
+    int tmpfd, rc = 1;
+
+    appendslot_t *slot = appender_get(ap, name);
+    if (slot == NULL) {
+        return 1;
+    }
+
+    if (pthread_mutex_trylock(&slot->lock) != 0) {
+        appendslot_unref(slot);
+        return 0;
+    }
+
+    // the owner may have published, aborted or been demoted by another
+    // commit between the lookup and the lock, it is gone from the object
+    if (slot->removed || slot->demoted) {
+        pthread_mutex_unlock(&slot->lock);
+        appendslot_unref(slot);
+        return 1;
+    }
+
+    pos = lseek(slot->fd, 0, SEEK_CUR);
+    tmpfd = create_tmpfile(tmpname, &status);
+    if (tmpfd < 0) {
+        rc = -1;
+    } else {
+        if (tmpname[0] != '\0') {
+            unlink(tmpname);
+        }
+
+        off = slot->base;
+        if (copy_file_range(slot->fd, &off, tmpfd, NULL, pos - slot->base, 0) != pos - slot->base
+            || appendslot_truncate(slot) < 0 || dup2(tmpfd, slot->fd) < 0) {
+            rc = -1;
+        }
+
+        close(tmpfd);
+    }
+
+    if (rc == 1) {
+        if (appendslot_record(slot, NULL) < 0) {
+            warn("failed to clear the journal record of %s", slot->name);
+        }
+
+        slot->demoted = true;
+        pthread_mutex_lock(&ap->lock);
+        appender_remove(ap, slot);
+        pthread_mutex_unlock(&ap->lock);
+    }
+
+    pthread_mutex_unlock(&slot->lock);
+    appendslot_unref(slot);
+    return rc;
+}
+
+// waits until the in-place writer of an object is no longer being serviced
+//
+// ap  : appender
+// name: object name
+//
+void appender_wait(appender_t *ap, char *name) {
+    appendslot_t *slot = appender_get(ap, name);
+
+    if (slot != NULL) {
+        pthread_mutex_lock(&slot->lock);
+        pthread_mutex_unlock(&slot->lock);
+        appendslot_unref(slot);
+    }
+}
+
+// called by the owner when it resumes. returns true if it is still the
+// in-place writer, or false if it was demoted while it was suspended, in
+// which case it has to release the slot and commit as a staged APPEND
+//
+// slot: owned slot
+//
+bool appendslot_enter(appendslot_t *slot) {
+    pthread_mutex_lock(&slot->lock);
+    return slot->demoted == false;
+}
+
+// called by the owner when it is suspended, allowing it to be demoted
+//
+// slot: owned slot
+//
+void appendslot_leave(appendslot_t *slot) {
+    pthread_mutex_unlock(&slot->lock);
+}
+
+// publishes the bytes of the owner by clearing its journal record and
+// dropping its slot, which makes them visible to readers. the owner must
+// hold the object's write lock and the slot lock. returns 0 on success, or
+// -1 if the record could not be cleared, in which case the bytes are
+// published but would be dropped by a restart
+//
+// slot: pointer to the owned slot, set to NULL
+//
+int appendslot_publish(appendslot_t **slot) {
+    appender_t *ap = (*slot)->ap;
+    int rc = appendslot_record(*slot, NULL);
+
+    pthread_mutex_lock(&ap->lock);
+    appender_remove(ap, *slot);
+    pthread_mutex_unlock(&ap->lock);
+    (*slot)->removed = true;
+
+    appendslot_leave(*slot);
+    appendslot_unref(*slot);
+    *slot = NULL;
+    return rc;
+}
+
+// releases a slot the owner was demoted from. the owner must hold the
+// slot lock
+//
+// slot: pointer to the owned slot, set to NULL
+//
+void appendslot_release(appendslot_t **slot) {
+    appendslot_leave(*slot);
+    appendslot_unref(*slot);
+    *slot = NULL;
+}
+
+// abandons an in-place APPEND that failed, truncating the object back to
+// its published length and mtime. does nothing but release the slot if the
+// owner was demoted. the owner must not hold the slot lock
+//
+// slot: pointer to the owned slot, set to NULL
+//
+void appendslot_abort(appendslot_t **slot) {
+    if (slot && *slot) {
+        appender_t *ap = (*slot)->ap;
+
+        pthread_mutex_lock(&(*slot)->lock);
+        if ((*slot)->demoted == false) {
+            // the record is kept if the object could not be truncated, so
+            // that the next startup tries again
+            if (appendslot_truncate(*slot) < 0) {
+                warn("failed to truncate %s after a failed APPEND", (*slot)->name);
+            } else if (appendslot_record(*slot, NULL) < 0) {
+                warn("failed to clear the journal record of %s", (*slot)->name);
+            }
+
+            pthread_mutex_lock(&ap->lock);
+            appender_remove(ap, *slot);
+            pthread_mutex_unlock(&ap->lock);
+            (*slot)->removed = true;
+        }
+        pthread_mutex_unlock(&(*slot)->lock);
+
+        appendslot_unref(*slot);
+        *slot = NULL;
+    }
+}
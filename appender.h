@@ -0,0 +1,38 @@
+#ifndef __APPENDER_H__
+#define __APPENDER_H__
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+typedef struct appender_t appender_t;
+
+typedef struct appendslot_t appendslot_t;
+
+struct store_t;
+
+int appender_recover(struct store_t *store);
+
+appender_t *appender_create(size_t nbuckets, bool sync);
+
+void appender_destroy(appender_t **ap);
+
+appendslot_t *appender_claim(appender_t *ap, char *name, int fd, struct stat *statbuf);
+
+void appender_clamp(appender_t *ap, char *name, struct stat *statbuf);
+
+int appender_demote(appender_t *ap, char *name);
+
+void appender_wait(appender_t *ap, char *name);
+
+bool appendslot_enter(appendslot_t *slot);
+
+void appendslot_leave(appendslot_t *slot);
+
+int appendslot_publish(appendslot_t **slot);
+
+void appendslot_release(appendslot_t **slot);
+
+void appendslot_abort(appendslot_t **slot);
+
+#endif
@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include <arpa/inet.h>
+#include <err.h>
+#include <math.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEAD_SIZE 256
+#define RECV_SIZE 65536
+
+uint64_t now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// sleeps until a time of now_ns()
+//
+void sleep_until(uint64_t ns) {
+    struct timespec wake = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+}
+
+// xorshift64*, one state per client
+//
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static double next_unit(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// parses fixed:N, uniform:A-B or exp:MEAN. returns -1 if the argument is
+// none of them
+//
+int parse_sizes(char *arg, sizes_t *sizes) {
+    unsigned long a, b;
+
+    if (sscanf(arg, "fixed:%lu", &a) == 1) {
+        *sizes = (sizes_t) { SIZE_FIXED, a, a };
+    } else if (sscanf(arg, "uniform:%lu-%lu", &a, &b) == 2 && a <= b) {
+        *sizes = (sizes_t) { SIZE_UNIFORM, a, b };
+    } else if (sscanf(arg, "exp:%lu", &a) == 1 && a > 0) {
+        *sizes = (sizes_t) { SIZE_EXP, a, MAX_SIZE };
+    } else {
+        return -1;
+    }
+
+    return sizes->a <= MAX_SIZE && sizes->b <= MAX_SIZE ? 0 : -1;
+}
+
+size_t next_size(sizes_t *sizes, uint64_t *state) {
+    double size;
+
+    switch (sizes->dist) {
+    case SIZE_FIXED: return sizes->a;
+    case SIZE_UNIFORM: return sizes->a + next_random(state) % (sizes->b - sizes->a + 1);
+    case SIZE_EXP:
+        size = -log(1.0 - next_unit(state)) * sizes->a;
+        return size > MAX_SIZE ? MAX_SIZE : (size_t) size;
+    }
+
+    return sizes->a;
+}
+
+// allocates the buffer every body is a prefix of
+//
+char *create_body(void) {
+    char *body = (char *) malloc(MAX_SIZE);
+
+    if (body == NULL) {
+        err(EXIT_FAILURE, "malloc");
+    }
+
+    memset(body, 'x', MAX_SIZE);
+    return body;
+}
+
+// fills in the address of a server. returns -1 if the host or port is bad
+//
+int parse_addr(char *host, char *port, struct sockaddr_in *addr) {
+    long num = strtol(port, NULL, 10);
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(num);
+    if (num <= 0 || num > UINT16_MAX || inet_pton(AF_INET, host, &addr->sin_addr) != 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// sends a buffer whole. returns the number of bytes sent, which is less
+// than len if the connection failed
+//
+static size_t send_all(int fd, char *buf, size_t len) {
+    size_t sent = 0;
+    ssize_t nbytes;
+
+    while (sent < len) {
+        nbytes = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (nbytes < 0) {
+            break;
+        }
+
+        sent += nbytes;
+    }
+
+    return sent;
+}
+
+// sends one request on a connection of its own and reads the response
+// until the server closes the connection. returns the status code, or -1
+// if the request failed
+//
+// addr  : address of the server
+// method: request method
+// name  : object name, without the leading slash
+// reqid : Request-Id of the request
+// body  : body of size bytes, sent as is
+// bytes : counter of the bytes sent and received
+//
+int http_request(struct sockaddr_in *addr, const char *method, const char *name, uint32_t reqid,
+    char *body, size_t size, uint64_t *bytes) {
+    char head[HEAD_SIZE], buf[RECV_SIZE];
+    size_t got = 0, sent;
+    ssize_t nbytes;
+    int fd, len, code = -1, one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, (struct sockaddr *) addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    len = snprintf(head, sizeof(head),
+        "%s /%s HTTP/1.1\r\nRequest-Id: %u\r\nContent-Length: %zu\r\n\r\n", method, name,
+        reqid, size);
+    if (len >= HEAD_SIZE || send_all(fd, head, len) < (size_t) len) {
+        close(fd);
+        return -1;
+    }
+
+    // a request the server rejects before reading its body is answered
+    // and closed while the body is still going out
+    sent = send_all(fd, body, size);
+
+    // the status line stays at the front of buf, the rest of the response
+    // is read over whatever follows it
+    while ((nbytes = recv(fd, buf + (got < 16 ? got : 16), RECV_SIZE - (got < 16 ? got : 16), 0))
+           > 0) {
+        got += nbytes;
+    }
+
+    if (got >= 12 && strncmp(buf, "HTTP/1.1 ", 9) == 0) {
+        code = atoi(buf + 9);
+    }
+
+    *bytes += got + len + sent;
+    close(fd);
+    return code >= 100 && code < MAX_CODE ? code : -1;
+}
+
+void add_sample(samples_t *samples, uint64_t lat) {
+    if (samples->n == samples->cap) {
+        samples->cap = samples->cap == 0 ? 4096 : samples->cap * 2;
+        samples->lat = (uint64_t *) realloc(samples->lat, samples->cap * sizeof(uint64_t));
+        if (samples->lat == NULL) {
+            err(EXIT_FAILURE, "realloc");
+        }
+    }
+
+    samples->lat[samples->n++] = lat;
+}
+
+void merge_samples(samples_t *into, samples_t *from) {
+    for (size_t i = 0; i < from->n; i++) {
+        add_sample(into, from->lat[i]);
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// the latency below which a fraction p of a sorted set falls, in
+// microseconds
+//
+double percentile(samples_t *s, double p) {
+    size_t i = (size_t) ceil(p * s->n);
+    return s->lat[i == 0 ? 0 : i - 1] / 1000.0;
+}
+
+// prints the exact percentiles of a set of latencies, sorting them
+//
+void print_latency(const char *name, samples_t *s) {
+    if (s->n == 0) {
+        return;
+    }
+
+    qsort(s->lat, s->n, sizeof(uint64_t), compare_u64);
+    printf("latency %-6s n %-9zu p50 %9.1fus p99 %9.1fus p999 %9.1fus max %9.1fus\n", name, s->n,
+        percentile(s, 0.5), percentile(s, 0.99), percentile(s, 0.999), s->lat[s->n - 1] / 1000.0);
+}
+
+void free_samples(samples_t *samples) {
+    free(samples->lat);
+    samples->lat = NULL;
+    samples->n = samples->cap = 0;
+}
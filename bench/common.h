@@ -0,0 +1,54 @@
+#ifndef __BENCH_COMMON_H__
+#define __BENCH_COMMON_H__
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// what the benchmark clients share: one-request connections to the server,
+// body size distributions and latency samples
+
+#define MAX_SIZE (64 << 20)
+#define MAX_CODE 600
+
+typedef enum { SIZE_FIXED, SIZE_UNIFORM, SIZE_EXP } sizedist_t;
+
+typedef struct {
+    sizedist_t dist;
+    size_t a, b;
+} sizes_t;
+
+typedef struct {
+    uint64_t *lat;
+    size_t n, cap;
+} samples_t;
+
+uint64_t now_ns(void);
+
+void sleep_until(uint64_t ns);
+
+uint64_t next_random(uint64_t *state);
+
+int parse_sizes(char *arg, sizes_t *sizes);
+
+size_t next_size(sizes_t *sizes, uint64_t *state);
+
+char *create_body(void);
+
+int parse_addr(char *host, char *port, struct sockaddr_in *addr);
+
+int http_request(struct sockaddr_in *addr, const char *method, const char *name, uint32_t reqid,
+    char *body, size_t size, uint64_t *bytes);
+
+void add_sample(samples_t *samples, uint64_t lat);
+
+void merge_samples(samples_t *into, samples_t *from);
+
+double percentile(samples_t *samples, double p);
+
+void print_latency(const char *name, samples_t *samples);
+
+void free_samples(samples_t *samples);
+
+#endif
@@ -0,0 +1,270 @@
+#include "common.h"
+#include <err.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// a load generator for httpserver. every thread is one client connection
+// at a time, and the server takes one request per connection.
+//
+// closed loop (the default): each of the clients sends its next request
+// as soon as the previous one is answered, which measures the throughput
+// the server sustains at that concurrency.
+//
+// open loop (-r rate): requests are scheduled at a fixed arrival rate
+// spread over the clients, and latency is measured from when a request was
+// due rather than when it was sent, so a server that falls behind is
+// charged for the queueing it causes.
+//
+// the objects are prefilled with a PUT each before the run, so GETs find
+// them. every request is timed and the report gives the exact percentiles
+
+#define NAME_SIZE 20
+#define NMETHODS  3
+
+typedef enum { BENCH_GET, BENCH_PUT, BENCH_APPEND } benchmethod_t;
+
+static const char *method_names[NMETHODS] = { "GET", "PUT", "APPEND" };
+
+typedef struct {
+    struct sockaddr_in addr;
+    int nclients;
+    double seconds;
+    double rate;
+    unsigned mix[NMETHODS];
+    sizes_t sizes;
+    int nkeys;
+    char *body;
+} config_t;
+
+typedef struct {
+    config_t *cfg;
+    int id;
+    uint64_t seed;
+    samples_t samples[NMETHODS];
+    uint64_t codes[MAX_CODE];
+    uint64_t failed;
+    uint64_t bytes;
+} client_t;
+
+static benchmethod_t next_method(config_t *cfg, uint64_t *state) {
+    unsigned total = cfg->mix[0] + cfg->mix[1] + cfg->mix[2];
+    unsigned pick = next_random(state) % total;
+
+    if (pick < cfg->mix[BENCH_GET]) {
+        return BENCH_GET;
+    }
+
+    return pick < cfg->mix[BENCH_GET] + cfg->mix[BENCH_PUT] ? BENCH_PUT : BENCH_APPEND;
+}
+
+// sends one request for an object. returns the status code, or -1 if the
+// request failed
+//
+// key : object number
+// size: body size of a PUT or APPEND
+//
+static int do_request(client_t *c, benchmethod_t method, int key, size_t size) {
+    char name[NAME_SIZE];
+
+    snprintf(name, sizeof(name), "b%07d", key);
+    return http_request(&c->cfg->addr, method_names[method], name, c->id, c->cfg->body,
+        method == BENCH_GET ? 0 : size, &c->bytes);
+}
+
+static void *run_client(void *arg) {
+    client_t *c = (client_t *) arg;
+    config_t *cfg = c->cfg;
+    uint64_t start = now_ns(), end = start + (uint64_t) (cfg->seconds * 1e9), due = start, sent;
+    uint64_t interval = cfg->rate > 0 ? (uint64_t) (cfg->nclients / cfg->rate * 1e9) : 0;
+    benchmethod_t method;
+    int code;
+
+    // spread the clients of an open loop over the first interval
+    due += interval * c->id / cfg->nclients;
+
+    while (due < end) {
+        if (interval > 0) {
+            sleep_until(due);
+        }
+
+        method = next_method(cfg, &c->seed);
+        sent = interval > 0 ? due : now_ns();
+        code = do_request(c, method, next_random(&c->seed) % cfg->nkeys,
+            next_size(&cfg->sizes, &c->seed));
+        if (code < 0) {
+            c->failed++;
+        } else {
+            c->codes[code]++;
+            add_sample(&c->samples[method], now_ns() - sent);
+        }
+
+        due = interval > 0 ? due + interval : now_ns();
+    }
+
+    return NULL;
+}
+
+// puts every object once, split over the clients
+//
+static void *prefill(void *arg) {
+    client_t *c = (client_t *) arg;
+
+    for (int key = c->id; key < c->cfg->nkeys; key += c->cfg->nclients) {
+        if (do_request(c, BENCH_PUT, key, next_size(&c->cfg->sizes, &c->seed)) < 0) {
+            c->failed++;
+        }
+    }
+
+    return NULL;
+}
+
+// runs every client to the end of the run and prints the report
+//
+static void run_clients(config_t *cfg, void *(*func)(void *), bool report) {
+    client_t *clients = (client_t *) calloc(cfg->nclients, sizeof(client_t));
+    pthread_t *threads = (pthread_t *) calloc(cfg->nclients, sizeof(pthread_t));
+    samples_t all[NMETHODS + 1] = { 0 };
+    uint64_t failed = 0, bytes = 0, requests = 0, start;
+    double seconds;
+
+    if (clients == NULL || threads == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+
+    start = now_ns();
+    for (int i = 0; i < cfg->nclients; i++) {
+        clients[i].cfg = cfg;
+        clients[i].id = i;
+        clients[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+        if (pthread_create(&threads[i], NULL, func, &clients[i]) != 0) {
+            err(EXIT_FAILURE, "pthread_create");
+        }
+    }
+
+    for (int i = 0; i < cfg->nclients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    seconds = (now_ns() - start) / 1e9;
+
+    for (int i = 0; i < cfg->nclients; i++) {
+        failed += clients[i].failed;
+        bytes += clients[i].bytes;
+    }
+
+    if (report == false) {
+        if (failed > 0) {
+            errx(EXIT_FAILURE, "%" PRIu64 " requests failed while prefilling", failed);
+        }
+        goto done;
+    }
+
+    // merge every client's samples, per method and overall
+    for (int m = 0; m < NMETHODS; m++) {
+        for (int i = 0; i < cfg->nclients; i++) {
+            merge_samples(&all[m], &clients[i].samples[m]);
+            merge_samples(&all[NMETHODS], &clients[i].samples[m]);
+        }
+        requests += all[m].n;
+    }
+
+    printf("mode %s clients %d duration %.1fs", cfg->rate > 0 ? "open" : "closed", cfg->nclients,
+        seconds);
+    if (cfg->rate > 0) {
+        printf(" rate %.0f/s", cfg->rate);
+    }
+    printf(" mix %u:%u:%u keys %d\n", cfg->mix[0], cfg->mix[1], cfg->mix[2], cfg->nkeys);
+    printf("requests %" PRIu64 " failed %" PRIu64 " throughput %.1f req/s %.2f MiB/s\n", requests,
+        failed, requests / seconds, bytes / seconds / (1 << 20));
+    print_latency("all", &all[NMETHODS]);
+    for (int m = 0; m < NMETHODS; m++) {
+        print_latency(method_names[m], &all[m]);
+    }
+
+    printf("codes");
+    for (int code = 0; code < MAX_CODE; code++) {
+        uint64_t n = 0;
+        for (int i = 0; i < cfg->nclients; i++) {
+            n += clients[i].codes[code];
+        }
+        if (n > 0) {
+            printf(" %d:%" PRIu64, code, n);
+        }
+    }
+    putchar('\n');
+
+    for (int m = 0; m <= NMETHODS; m++) {
+        free_samples(&all[m]);
+    }
+
+done:
+    for (int i = 0; i < cfg->nclients; i++) {
+        for (int m = 0; m < NMETHODS; m++) {
+            free_samples(&clients[i].samples[m]);
+        }
+    }
+    free(clients);
+    free(threads);
+}
+
+static void usage(char *exec) {
+    fprintf(stderr,
+        "usage: %s [-c clients] [-d seconds] [-r rate] [-m get:put:append] "
+        "[-s fixed:N|uniform:A-B|exp:MEAN] [-k keys] [-h host] <port>\n",
+        exec);
+}
+
+int main(int argc, char *argv[]) {
+    config_t cfg = {
+        .nclients = 16,
+        .seconds = 10,
+        .mix = { 80, 15, 5 },
+        .sizes = { SIZE_EXP, 4096, MAX_SIZE },
+        .nkeys = 1000,
+    };
+    char *host = "127.0.0.1";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:d:r:m:s:k:h:")) != -1) {
+        switch (opt) {
+        case 'c': cfg.nclients = atoi(optarg); break;
+        case 'd': cfg.seconds = atof(optarg); break;
+        case 'r': cfg.rate = atof(optarg); break;
+        case 'm':
+            if (sscanf(optarg, "%u:%u:%u", &cfg.mix[0], &cfg.mix[1], &cfg.mix[2]) != 3
+                || cfg.mix[0] + cfg.mix[1] + cfg.mix[2] == 0) {
+                errx(EXIT_FAILURE, "bad mix: %s", optarg);
+            }
+            break;
+        case 's':
+            if (parse_sizes(optarg, &cfg.sizes) < 0) {
+                errx(EXIT_FAILURE, "bad sizes: %s", optarg);
+            }
+            break;
+        case 'k': cfg.nkeys = atoi(optarg); break;
+        case 'h': host = optarg; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 || cfg.nclients <= 0 || cfg.seconds <= 0 || cfg.rate < 0
+        || cfg.nkeys <= 0 || cfg.nkeys > 9999999) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (parse_addr(host, argv[optind], &cfg.addr) < 0) {
+        errx(EXIT_FAILURE, "bad address: %s:%s", host, argv[optind]);
+    }
+
+    cfg.body = create_body();
+
+    run_clients(&cfg, prefill, false);
+    run_clients(&cfg, run_client, true);
+
+    free(cfg.body);
+    return EXIT_SUCCESS;
+}
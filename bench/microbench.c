@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+
+#include "linkedlist.h"
+#include "queue.h"
+#include "redblack.h"
+#include "request.h"
+#include <err.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// microbenchmarks of the server's data structures and request parsing,
+// linked against the same objects as httpserver. every benchmark prints
+// the time and the heap allocations per operation, for judging a
+// replacement against what is there now
+//
+//     bench/microbench [-n ops] [-p producers] [-c consumers] [list|queue|redblack|parse|recv ...]
+
+#define BATCH 1024
+
+// allocations are counted by interposing on malloc, which also sees the
+// allocations libc makes for the code under test (regcomp's, say). the
+// __libc_ entry points are glibc's
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static _Thread_local uint64_t local_allocs;
+static _Atomic uint64_t thread_allocs;
+
+void *malloc(size_t size) {
+    local_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    local_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    local_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+// a corpus of request headers as curl, browsers and scripts send them
+static const char *corpus[] = {
+    "GET /index.html HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: curl/7.81.0\r\n"
+    "Accept: */*\r\n\r\n",
+    "PUT /foo.txt HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: curl/7.81.0\r\nAccept: */*\r\n"
+    "Request-Id: 42\r\nContent-Length: 1024\r\n\r\n",
+    "GET /photo.jpg HTTP/1.1\r\nHost: localhost:8080\r\nConnection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\nUpgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8"
+    "\r\nAccept-Encoding: gzip, deflate, br\r\nAccept-Language: en-US,en;q=0.9\r\n"
+    "If-None-Match: \"5f3a-1c8-65a1b2c3\"\r\nIf-Modified-Since: Tue, 09 Jan 2024 10:12:03 GMT\r\n"
+    "\r\n",
+    "APPEND /events.log HTTP/1.1\r\nHost: 127.0.0.1:8080\r\nUser-Agent: python-requests/2.31.0\r\n"
+    "Accept-Encoding: gzip, deflate\r\nAccept: */*\r\nConnection: keep-alive\r\n"
+    "Request-Id: 7\r\nTransfer-Encoding: chunked\r\nExpect: 100-continue\r\n\r\n",
+    "GET /video.mp4 HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: Wget/1.21.2\r\n"
+    "Accept: */*\r\nRange: bytes=1048576-2097151\r\nRequest-Id: 9001\r\n\r\n",
+    "HEAD /a HTTP/1.1\r\n\r\n",
+    "PUT /data.bin HTTP/1.1\r\nHost: localhost:8080\r\nContent-Type: application/octet-stream\r\n"
+    "Content-Length: 65536\r\nExpect: 100-continue\r\n\r\n",
+    "GET /small.txt HTTP/1.1\r\nHost: localhost:8080\r\n\r\n",
+};
+
+#define NCORPUS (sizeof(corpus) / sizeof(corpus[0]))
+
+typedef struct {
+    queue_t *q;
+    pthread_mutex_t lock;
+    pthread_cond_t notify;
+    uint64_t nitems, consumed;
+    int nproducers;
+} workq_t;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// counts the allocations of a thread that is about to exit
+//
+static void flush_allocs(void) {
+    atomic_fetch_add(&thread_allocs, local_allocs);
+    local_allocs = 0;
+}
+
+static uint64_t take_allocs(void) {
+    uint64_t n = local_allocs + atomic_exchange(&thread_allocs, 0);
+
+    local_allocs = 0;
+    return n;
+}
+
+static void report(const char *name, uint64_t nops, uint64_t ns, uint64_t allocs) {
+    printf("%-34s %10" PRIu64 " ops %10.1f ns/op %8.2f allocs/op\n", name, nops,
+        (double) ns / nops, (double) allocs / nops);
+}
+
+static void bench_list(uint64_t n) {
+    list_t *ll = ll_create();
+    uint64_t start;
+
+    take_allocs();
+    start = now_ns();
+    for (uint64_t i = 0; i < n; i++) {
+        ll_push_front(ll, (void *) (uintptr_t) (i + 1));
+    }
+    report("ll_push_front", n, now_ns() - start, take_allocs());
+
+    start = now_ns();
+    for (uint64_t i = 0; i < n; i++) {
+        ll_pop_back(ll);
+    }
+    report("ll_pop_back", n, now_ns() - start, take_allocs());
+
+    ll_destroy(&ll, NULL);
+}
+
+// producers hand items to consumers through the queue the way the main
+// thread hands connections to the threadpool's workers
+//
+static void *produce(void *arg) {
+    workq_t *wq = (workq_t *) arg;
+
+    for (uint64_t i = 0; i < wq->nitems / wq->nproducers; i++) {
+        pthread_mutex_lock(&wq->lock);
+        enqueue(wq->q, (void *) (uintptr_t) (i + 1));
+        pthread_cond_signal(&wq->notify);
+        pthread_mutex_unlock(&wq->lock);
+    }
+
+    flush_allocs();
+    return NULL;
+}
+
+static void *consume(void *arg) {
+    workq_t *wq = (workq_t *) arg;
+    void *item;
+
+    pthread_mutex_lock(&wq->lock);
+    while (wq->consumed < wq->nitems) {
+        if (dequeue(wq->q, &item) == false) {
+            pthread_cond_wait(&wq->notify, &wq->lock);
+            continue;
+        }
+
+        if (++wq->consumed == wq->nitems) {
+            pthread_cond_broadcast(&wq->notify);
+        }
+    }
+    pthread_mutex_unlock(&wq->lock);
+
+    flush_allocs();
+    return NULL;
+}
+
+static void bench_queue(uint64_t n, int nproducers, int nconsumers) {
+    workq_t wq;
+    pthread_t threads[nproducers + nconsumers];
+    char name[64];
+    uint64_t start;
+
+    wq.q = queue_create();
+    wq.nproducers = nproducers;
+    wq.nitems = n / nproducers * nproducers;
+    wq.consumed = 0;
+    pthread_mutex_init(&wq.lock, NULL);
+    pthread_cond_init(&wq.notify, NULL);
+
+    take_allocs();
+    start = now_ns();
+    for (int i = 0; i < nconsumers; i++) {
+        pthread_create(&threads[i], NULL, consume, &wq);
+    }
+    for (int i = 0; i < nproducers; i++) {
+        pthread_create(&threads[nconsumers + i], NULL, produce, &wq);
+    }
+    for (int i = 0; i < nproducers + nconsumers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    snprintf(name, sizeof(name), "enqueue+dequeue %dp/%dc", nproducers, nconsumers);
+    report(name, wq.nitems, now_ns() - start, take_allocs());
+
+    queue_destroy(&wq.q, NULL);
+    pthread_mutex_destroy(&wq.lock);
+    pthread_cond_destroy(&wq.notify);
+}
+
+// inserts keys in one random order and extracts them in another
+//
+static void bench_redblack(uint64_t n) {
+    int *keys = (int *) malloc(n * sizeof(int));
+    redblack_t *rbt = redblack_create();
+    uint64_t seed = 88172645463325252ULL, start;
+    char name[64];
+
+    if (keys == NULL || rbt == NULL) {
+        err(EXIT_FAILURE, "malloc");
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        keys[i] = (int) i;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint64_t i = n - 1; i > 0; i--) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            uint64_t j = seed % (i + 1);
+            int key = keys[i];
+            keys[i] = keys[j];
+            keys[j] = key;
+        }
+
+        take_allocs();
+        start = now_ns();
+        for (uint64_t i = 0; i < n; i++) {
+            if (pass == 0) {
+                redblack_insert(rbt, keys[i], (connection_t *) (uintptr_t) (keys[i] + 1));
+            } else if (redblack_extract(rbt, keys[i]) == NULL) {
+                errx(EXIT_FAILURE, "redblack lost key %d", keys[i]);
+            }
+        }
+
+        snprintf(name, sizeof(name), "%s %" PRIu64 " keys",
+            pass == 0 ? "redblack_insert" : "redblack_extract", n);
+        report(name, n, now_ns() - start, take_allocs());
+    }
+
+    redblack_destroy(&rbt);
+    free(keys);
+}
+
+// parses the corpus a batch of fresh requests at a time, the requests are
+// set up and torn down outside the timing
+//
+static void bench_parse(uint64_t n) {
+    request_t *reqs = (request_t *) malloc(BATCH * sizeof(request_t));
+    uint64_t ns = 0, allocs = 0, done = 0, start;
+
+    if (reqs == NULL) {
+        err(EXIT_FAILURE, "malloc");
+    }
+
+    while (done < n) {
+        for (int i = 0; i < BATCH; i++) {
+            const char *header = corpus[(done + i) % NCORPUS];
+            reqs[i] = request_create();
+            reqs[i].header.size = strlen(header);
+            memcpy(reqs[i].header.buf, header, reqs[i].header.size);
+        }
+
+        take_allocs();
+        start = now_ns();
+        for (int i = 0; i < BATCH; i++) {
+            parse_http_request(&reqs[i]);
+        }
+        ns += now_ns() - start;
+        allocs += take_allocs();
+
+        for (int i = 0; i < BATCH; i++) {
+            if (reqs[i].status != OK) {
+                errx(EXIT_FAILURE, "corpus header %" PRIu64 " parsed with status %d",
+                    (done + i) % NCORPUS, reqs[i].status);
+            }
+            request_destroy(&reqs[i]);
+        }
+        done += BATCH;
+    }
+
+    report("parse_http_request", done, ns, allocs);
+    free(reqs);
+}
+
+// receives the corpus over a socketpair. every receive is fed by a send of
+// its header, which the baseline times on its own with a plain recv
+//
+static void bench_recv(uint64_t n) {
+    char buf[REQSIZE];
+    size_t lens[NCORPUS];
+    request_t req;
+    uint64_t start;
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        err(EXIT_FAILURE, "socketpair");
+    }
+
+    for (size_t i = 0; i < NCORPUS; i++) {
+        lens[i] = strlen(corpus[i]);
+    }
+
+    take_allocs();
+    start = now_ns();
+    for (uint64_t i = 0; i < n; i++) {
+        send(sv[1], corpus[i % NCORPUS], lens[i % NCORPUS], 0);
+        recv(sv[0], buf, sizeof(buf), MSG_DONTWAIT);
+    }
+    report("send+recv baseline", n, now_ns() - start, take_allocs());
+
+    start = now_ns();
+    for (uint64_t i = 0; i < n; i++) {
+        req = request_create();
+        send(sv[1], corpus[i % NCORPUS], lens[i % NCORPUS], 0);
+        recv_http_request(sv[0], &req);
+        if (req.state != PARSE_HEADER) {
+            errx(EXIT_FAILURE, "recv_http_request failed with status %d", req.status);
+        }
+    }
+    report("send+recv_http_request", n, now_ns() - start, take_allocs());
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void usage(char *exec) {
+    fprintf(stderr,
+        "usage: %s [-n ops] [-p producers] [-c consumers] [list|queue|redblack|parse|recv ...]\n",
+        exec);
+}
+
+static bool selected(int argc, char *argv[], const char *name) {
+    if (optind == argc) {
+        return true;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t n = 1000000;
+    int opt, nproducers = 4, nconsumers = 4;
+
+    while ((opt = getopt(argc, argv, "n:p:c:")) != -1) {
+        switch (opt) {
+        case 'n': n = strtoull(optarg, NULL, 10); break;
+        case 'p': nproducers = atoi(optarg); break;
+        case 'c': nconsumers = atoi(optarg); break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (n == 0 || nproducers <= 0 || nconsumers <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (selected(argc, argv, "list")) {
+        bench_list(n);
+    }
+
+    if (selected(argc, argv, "queue")) {
+        bench_queue(n, 1, 1);
+        bench_queue(n, nproducers, nconsumers);
+    }
+
+    if (selected(argc, argv, "redblack")) {
+        for (uint64_t keys = 10000; keys <= 1000000; keys *= 10) {
+            bench_redblack(keys);
+        }
+    }
+
+    if (selected(argc, argv, "parse")) {
+        bench_parse(n / 10);
+    }
+
+    if (selected(argc, argv, "recv")) {
+        bench_recv(n / 10);
+    }
+
+    return EXIT_SUCCESS;
+}
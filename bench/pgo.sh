@@ -0,0 +1,98 @@
+#!/bin/sh
+# builds httpserver with profile-guided optimization and link-time
+# optimization from a run of the bench workload, and compares its median
+# throughput over PGO_ROUNDS runs with the same build without them. clang's
+# profiles are merged with llvm-profdata, gcc's are merged by the
+# instrumented server itself
+#
+#     CC=... CFLAGS=... PGOFLAGS=... [PGO_SECONDS=5] [PGO_ROUNDS=3] bench/pgo.sh [port]
+#
+# the optimized httpserver is left in place of the usual one
+
+set -e
+
+port=${1:-18090}
+root=$(cd "$(dirname "$0")/.." && pwd)
+cd "$root"
+
+CC=${CC:-cc}
+PGOFLAGS=${PGOFLAGS:--O2}
+LLVM_PROFDATA=${LLVM_PROFDATA:-llvm-profdata}
+PGO_SECONDS=${PGO_SECONDS:-5}
+PGO_ROUNDS=${PGO_ROUNDS:-3}
+SERVER_FLAGS=${SERVER_FLAGS:--t 4}
+
+profdir=$root/pgo
+rm -rf "$profdir"
+mkdir -p "$profdir"
+
+if $CC --version | grep -q clang; then
+    generate="-fprofile-instr-generate"
+    use="-fprofile-instr-use=$profdir/httpserver.profdata -flto"
+    export LLVM_PROFILE_FILE="$profdir/httpserver-%p.profraw"
+else
+    generate="-fprofile-generate -fprofile-update=atomic -fprofile-dir=$profdir"
+    use="-fprofile-use -fprofile-dir=$profdir -fprofile-correction -flto=auto"
+fi
+
+# builds httpserver with extra flags and keeps it under a name of its own
+build() {
+    make tidy >/dev/null
+    rm -f httpserver
+    make CC="$CC" CFLAGS="$CFLAGS $PGOFLAGS $2" all >/dev/null
+    mv httpserver "$profdir/$1"
+}
+
+# the workload the profile is taken from: small and large bodies in a mix
+# of methods, and slow clients to drive the suspend and resume path
+train() {
+    HTTPSERVER=$profdir/httpserver.instr bench/run.sh "$port" "$SERVER_FLAGS" loadgen \
+        -c 16 -d "$PGO_SECONDS" -m 60:25:15 -s exp:4096 -k 1000
+    HTTPSERVER=$profdir/httpserver.instr bench/run.sh "$port" "$SERVER_FLAGS" loadgen \
+        -c 4 -d "$PGO_SECONDS" -m 50:40:10 -s uniform:65536-4194304 -k 50
+    HTTPSERVER=$profdir/httpserver.instr bench/run.sh "$port" "$SERVER_FLAGS" slowclients \
+        -c 4 -d 1 -n 200 -b 16 -g 65536
+}
+
+# prints the throughput of a loadgen run of a build, in requests per second
+measure() {
+    HTTPSERVER=$profdir/$1 bench/run.sh "$port" "$SERVER_FLAGS" loadgen \
+        -c 16 -d "$PGO_SECONDS" -m 80:15:5 -s exp:4096 -k 1000 | awk '/^requests/ { print $6 }'
+}
+
+median() {
+    tr ' ' '\n' | sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+echo "building the baseline and the instrumented server"
+build httpserver.base ""
+build httpserver.instr "$generate"
+
+echo "training"
+train >/dev/null
+
+if [ -n "$LLVM_PROFILE_FILE" ]; then
+    $LLVM_PROFDATA merge -output="$profdir/httpserver.profdata" "$profdir"/*.profraw
+fi
+
+echo "building with the profile"
+build httpserver.pgo "$use"
+
+# the builds take turns, so that whatever else the machine is doing weighs
+# on both alike
+base=""
+pgo=""
+for round in $(seq "$PGO_ROUNDS"); do
+    base="$base $(measure httpserver.base)"
+    pgo="$pgo $(measure httpserver.pgo)"
+    echo "round $round: baseline $(echo $base | awk '{ print $NF }') pgo+lto $(echo $pgo | awk '{ print $NF }') req/s"
+done
+
+base=$(echo $base | median)
+pgo=$(echo $pgo | median)
+awk -v base="$base" -v pgo="$pgo" -v flags="$PGOFLAGS" 'BEGIN {
+    printf "median throughput %s: %.1f req/s, %s pgo+lto: %.1f req/s (%+.1f%%)\n",
+        flags, base, flags, pgo, (pgo / base - 1) * 100 }'
+
+make tidy >/dev/null
+cp "$profdir/httpserver.pgo" httpserver
@@ -0,0 +1,406 @@
+#include "common.h"
+#include <err.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// replays a request log against a server and checks that every request
+// gets the status code the log recorded for it.
+//
+// the log is the server's text log, METHOD,/OBJECT,CODE,REQ-ID a line, or
+// the output of tools/logconvert -t, which adds the time of each request.
+// the requests of an object are all sent by the same client in the order
+// of the log, which is the order the server logged them in, so the codes
+// are reproducible while the clients run concurrently. PUT and APPEND
+// bodies are synthetic, sized by a distribution.
+//
+// the objects the log shows existing before their first request are put
+// before the replay starts, into what should be an empty directory. a
+// timed log is replayed at its own pace times -x, and latency is measured
+// from when each request was due. without times, or with -x 0, requests
+// go out as fast as the clients get their answers
+
+#define NAME_SIZE 4096
+#define NMETHODS  4
+
+typedef enum { REPLAY_GET, REPLAY_PUT, REPLAY_APPEND, REPLAY_HEAD } replaymethod_t;
+
+static const char *method_names[NMETHODS] = { "GET", "PUT", "APPEND", "HEAD" };
+
+typedef struct {
+    replaymethod_t method;
+    char *name;
+    int code;
+    uint32_t reqid;
+    uint64_t time;
+    size_t line;
+    bool first; // first request of its object in the log
+} record_t;
+
+typedef struct {
+    record_t *recs;
+    size_t n, cap;
+    bool timed;
+} replaylog_t;
+
+typedef struct {
+    struct sockaddr_in addr;
+    replaylog_t log;
+    int nclients;
+    double speed;
+    sizes_t sizes;
+    bool prefill;
+    bool verbose;
+    char *body;
+    uint64_t start, first;
+    pthread_barrier_t ready;
+} config_t;
+
+typedef struct {
+    config_t *cfg;
+    int id;
+    uint64_t seed;
+    size_t *todo;
+    size_t ntodo, cap;
+    samples_t samples[NMETHODS];
+    uint64_t mismatched[NMETHODS];
+    uint64_t failed, prefilled, bytes;
+} client_t;
+
+static int method_of(const char *name) {
+    for (int m = 0; m < NMETHODS; m++) {
+        if (strcmp(name, method_names[m]) == 0) {
+            return m;
+        }
+    }
+
+    return -1;
+}
+
+// FNV-1a, which picks the client an object's requests go to
+//
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+
+    for (; *name != '\0'; name++) {
+        h = (h ^ (uint8_t) *name) * 16777619u;
+    }
+
+    return h;
+}
+
+// reads every request of a log. lines that are not requests are skipped
+// and counted
+//
+static void read_log(FILE *in, replaylog_t *log) {
+    char method[16], name[NAME_SIZE], *line = NULL;
+    size_t len = 0, lineno = 0, skipped = 0;
+    uint64_t time;
+    uint32_t reqid;
+    int code, n;
+    record_t *rec;
+
+    while (getline(&line, &len, in) > 0) {
+        lineno++;
+        n = sscanf(line, "%15[^,],/%4095[^,],%d,%" SCNu32 ",%" SCNu64, method, name, &code, &reqid,
+            &time);
+        if (n < 4 || method_of(method) < 0) {
+            skipped++;
+            continue;
+        }
+
+        if (log->n == log->cap) {
+            log->cap = log->cap == 0 ? 4096 : log->cap * 2;
+            log->recs = (record_t *) realloc(log->recs, log->cap * sizeof(record_t));
+            if (log->recs == NULL) {
+                err(EXIT_FAILURE, "realloc");
+            }
+        }
+
+        // a log is timed only if every line is
+        log->timed = (log->n == 0 || log->timed) && n == 5;
+        rec = &log->recs[log->n++];
+        *rec = (record_t) {
+            method_of(method), strdup(name), code, reqid, n == 5 ? time : 0, lineno, false
+        };
+        if (rec->name == NULL) {
+            err(EXIT_FAILURE, "strdup");
+        }
+    }
+
+    free(line);
+    if (skipped > 0) {
+        fprintf(stderr, "replay: skipped %zu lines that are not requests\n", skipped);
+    }
+}
+
+// marks the first request of every object, with an open-addressed table
+// of the names seen
+//
+static void mark_first(replaylog_t *log) {
+    size_t nslots = 1, i;
+    char **seen;
+
+    while (nslots < 2 * log->n) {
+        nslots *= 2;
+    }
+
+    seen = (char **) calloc(nslots, sizeof(char *));
+    if (seen == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+
+    for (size_t r = 0; r < log->n; r++) {
+        for (i = hash_name(log->recs[r].name) & (nslots - 1); seen[i] != NULL;
+             i = (i + 1) & (nslots - 1)) {
+            if (strcmp(seen[i], log->recs[r].name) == 0) {
+                break;
+            }
+        }
+
+        log->recs[r].first = seen[i] == NULL;
+        seen[i] = log->recs[r].name;
+    }
+
+    free(seen);
+}
+
+static void add_todo(client_t *c, size_t i) {
+    if (c->ntodo == c->cap) {
+        c->cap = c->cap == 0 ? 1024 : c->cap * 2;
+        c->todo = (size_t *) realloc(c->todo, c->cap * sizeof(size_t));
+        if (c->todo == NULL) {
+            err(EXIT_FAILURE, "realloc");
+        }
+    }
+
+    c->todo[c->ntodo++] = i;
+}
+
+// whether the first request of an object shows the object existing before
+// the log starts
+//
+static bool existed(record_t *first) {
+    return first->code == 200;
+}
+
+static size_t body_size(client_t *c, record_t *rec) {
+    if (rec->method == REPLAY_PUT || rec->method == REPLAY_APPEND) {
+        return next_size(&c->cfg->sizes, &c->seed);
+    }
+
+    return 0;
+}
+
+static void *run_client(void *arg) {
+    client_t *c = (client_t *) arg;
+    config_t *cfg = c->cfg;
+    record_t *recs = cfg->log.recs, *rec;
+    bool paced = cfg->log.timed && cfg->speed > 0;
+    uint64_t due = 0, sent;
+    int code;
+
+    for (size_t i = 0; cfg->prefill && i < c->ntodo; i++) {
+        rec = &recs[c->todo[i]];
+        if (rec->first && existed(rec)) {
+            code = http_request(&cfg->addr, "PUT", rec->name, 0, cfg->body, body_size(c, rec),
+                &c->bytes);
+            if (code != 200 && code != 201) {
+                errx(EXIT_FAILURE, "prefilling /%s failed with %d", rec->name, code);
+            }
+            c->prefilled++;
+        }
+    }
+
+    // once every client has prefilled, main sets the start of the replay
+    pthread_barrier_wait(&cfg->ready);
+    pthread_barrier_wait(&cfg->ready);
+
+    for (size_t i = 0; i < c->ntodo; i++) {
+        rec = &recs[c->todo[i]];
+        if (paced) {
+            due = cfg->start + (uint64_t) ((rec->time - cfg->first) * 1000 / cfg->speed);
+            sleep_until(due);
+        }
+
+        sent = paced ? due : now_ns();
+        code = http_request(&cfg->addr, method_names[rec->method], rec->name, rec->reqid,
+            cfg->body, body_size(c, rec), &c->bytes);
+        if (code < 0) {
+            c->failed++;
+            continue;
+        }
+
+        add_sample(&c->samples[rec->method], now_ns() - sent);
+        if (code != rec->code) {
+            c->mismatched[rec->method]++;
+            if (cfg->verbose) {
+                printf("line %zu: %s /%s expected %d got %d\n", rec->line,
+                    method_names[rec->method], rec->name, rec->code, code);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void usage(char *exec) {
+    fprintf(stderr,
+        "usage: %s [-c clients] [-x speed] [-s fixed:N|uniform:A-B|exp:MEAN] [-n] [-v] "
+        "[-h host] <port> [log]\n",
+        exec);
+}
+
+int main(int argc, char *argv[]) {
+    config_t cfg = {
+        .nclients = 32,
+        .speed = 1,
+        .sizes = { SIZE_EXP, 4096, MAX_SIZE },
+        .prefill = true,
+    };
+    uint64_t failed = 0, prefilled = 0, mismatched = 0, bytes = 0, requests = 0, elapsed;
+    samples_t all[NMETHODS + 1] = { 0 };
+    char *host = "127.0.0.1";
+    pthread_t *threads;
+    client_t *clients;
+    FILE *in = stdin;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:x:s:nvh:")) != -1) {
+        switch (opt) {
+        case 'c': cfg.nclients = atoi(optarg); break;
+        case 'x': cfg.speed = atof(optarg); break;
+        case 's':
+            if (parse_sizes(optarg, &cfg.sizes) < 0) {
+                errx(EXIT_FAILURE, "bad sizes: %s", optarg);
+            }
+            break;
+        case 'n': cfg.prefill = false; break;
+        case 'v': cfg.verbose = true; break;
+        case 'h': host = optarg; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 && optind != argc - 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (cfg.nclients <= 0 || cfg.speed < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (parse_addr(host, argv[optind], &cfg.addr) < 0) {
+        errx(EXIT_FAILURE, "bad address: %s:%s", host, argv[optind]);
+    }
+
+    if (optind == argc - 2 && (in = fopen(argv[optind + 1], "r")) == NULL) {
+        err(EXIT_FAILURE, "%s", argv[optind + 1]);
+    }
+
+    read_log(in, &cfg.log);
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    if (cfg.log.n == 0) {
+        errx(EXIT_FAILURE, "no requests to replay");
+    }
+
+    clients = (client_t *) calloc(cfg.nclients, sizeof(client_t));
+    threads = (pthread_t *) calloc(cfg.nclients, sizeof(pthread_t));
+    if (clients == NULL || threads == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+
+    for (int i = 0; i < cfg.nclients; i++) {
+        clients[i].cfg = &cfg;
+        clients[i].id = i;
+        clients[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+    }
+
+    mark_first(&cfg.log);
+    cfg.first = UINT64_MAX;
+    for (size_t i = 0; i < cfg.log.n; i++) {
+        cfg.first = cfg.log.recs[i].time < cfg.first ? cfg.log.recs[i].time : cfg.first;
+    }
+
+    for (size_t i = 0; i < cfg.log.n; i++) {
+        add_todo(&clients[hash_name(cfg.log.recs[i].name) % cfg.nclients], i);
+    }
+
+    cfg.body = create_body();
+
+    // the replay starts when every client has prefilled its objects
+    pthread_barrier_init(&cfg.ready, NULL, cfg.nclients + 1);
+    for (int i = 0; i < cfg.nclients; i++) {
+        if (pthread_create(&threads[i], NULL, run_client, &clients[i]) != 0) {
+            err(EXIT_FAILURE, "pthread_create");
+        }
+    }
+
+    pthread_barrier_wait(&cfg.ready);
+    cfg.start = now_ns();
+    pthread_barrier_wait(&cfg.ready);
+
+    for (int i = 0; i < cfg.nclients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = now_ns() - cfg.start;
+
+    for (int i = 0; i < cfg.nclients; i++) {
+        for (int m = 0; m < NMETHODS; m++) {
+            merge_samples(&all[m], &clients[i].samples[m]);
+            merge_samples(&all[NMETHODS], &clients[i].samples[m]);
+            mismatched += clients[i].mismatched[m];
+            free_samples(&clients[i].samples[m]);
+        }
+        failed += clients[i].failed;
+        prefilled += clients[i].prefilled;
+        bytes += clients[i].bytes;
+        free(clients[i].todo);
+    }
+    requests = all[NMETHODS].n;
+
+    printf("log %zu requests%s clients %d prefilled %" PRIu64 " objects", cfg.log.n,
+        cfg.log.timed ? " timed" : "", cfg.nclients, prefilled);
+    if (cfg.log.timed && cfg.speed > 0) {
+        printf(" speed %gx", cfg.speed);
+    }
+    printf("\nrequests %" PRIu64 " failed %" PRIu64 " duration %.2fs throughput %.1f req/s "
+           "%.2f MiB/s\n",
+        requests, failed, elapsed / 1e9, requests / (elapsed / 1e9),
+        bytes / (elapsed / 1e9) / (1 << 20));
+    print_latency("all", &all[NMETHODS]);
+    for (int m = 0; m < NMETHODS; m++) {
+        print_latency(method_names[m], &all[m]);
+    }
+
+    printf("codes matched %" PRIu64 " mismatched %" PRIu64, requests - mismatched, mismatched);
+    for (int m = 0; m < NMETHODS && mismatched > 0; m++) {
+        uint64_t n = 0;
+        for (int i = 0; i < cfg.nclients; i++) {
+            n += clients[i].mismatched[m];
+        }
+        printf(" %s:%" PRIu64, method_names[m], n);
+    }
+    putchar('\n');
+
+    for (int m = 0; m <= NMETHODS; m++) {
+        free_samples(&all[m]);
+    }
+    for (size_t i = 0; i < cfg.log.n; i++) {
+        free(cfg.log.recs[i].name);
+    }
+    free(cfg.log.recs);
+    free(cfg.body);
+    free(clients);
+    free(threads);
+    pthread_barrier_destroy(&cfg.ready);
+    return failed == 0 && mismatched == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
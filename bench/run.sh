@@ -0,0 +1,35 @@
+#!/bin/sh
+# starts httpserver in a scratch directory on a local port, runs one of the
+# benchmark clients against it and stops the server again. HTTPSERVER
+# picks another server binary
+#
+#     bench/run.sh <port> "<server flags>" <loadgen|replay|slowclients> [client flags]
+
+set -e
+
+port=$1
+server_flags=$2
+client=$3
+shift 3
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+server=$(realpath "${HTTPSERVER:-$root/httpserver}")
+dir=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; wait $pid 2>/dev/null; rm -rf "$dir"' EXIT
+
+cd "$dir"
+"$server" $server_flags "$port" 2>server.log &
+pid=$!
+
+# wait for the server to take connections
+for i in $(seq 50); do
+    if ! kill -0 $pid 2>/dev/null; then
+        cat server.log >&2
+        exit 1
+    fi
+    "$root/bench/loadgen" -c 1 -d 0.01 -k 1 -m 1:0:0 "$port" >/dev/null 2>&1 && break
+    sleep 0.1
+done
+
+echo "server: $(basename "$server") $server_flags"
+"$root/bench/$client" "$@" "$port"
@@ -0,0 +1,431 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// measures how slow and misbehaving clients hurt the latency of well
+// behaved ones, by driving the server's suspend and resume path.
+//
+// a few closed-loop clients send small GETs and PUTs for the whole run.
+// for the first half they have the server to themselves, for the second
+// half one thread also keeps thousands of slow connections open:
+//
+// trickle : PUTs whose header and body go out a few bytes every interval
+// stall   : PUTs that send their header and half their body, then nothing
+//           more until the run ends
+// slowread: GETs of a large object that read the response a few bytes
+//           every interval through a small receive buffer
+//
+// a slow connection that finishes is replaced with a new one of its kind.
+// the second half starts once every slow connection is open, however long
+// the server takes to accept them. the report gives the well-behaved
+// clients' latency in both halves
+
+#define NAME_SIZE 20
+#define HEAD_SIZE 128
+#define NKINDS    3
+#define RCVBUF    4096
+#define SLOW_OBJECT "slowget"
+
+typedef enum { SLOW_TRICKLE, SLOW_STALL, SLOW_READ } slowkind_t;
+
+static const char *kind_names[NKINDS] = { "trickle", "stall", "slowread" };
+
+typedef struct {
+    slowkind_t kind;
+    int fd;
+    char head[HEAD_SIZE];
+    size_t hlen, len, pos; // request is the head then len - hlen body bytes
+    uint64_t next;         // when the connection is next stepped
+    int id;
+} slowconn_t;
+
+typedef struct {
+    struct sockaddr_in addr;
+    int nclients;
+    double seconds;
+    int nslow;
+    unsigned mix[NKINDS];
+    uint64_t interval;
+    size_t step;
+    size_t putsize;
+    size_t getsize;
+    int nkeys;
+    char *body;
+    uint64_t start, attack;
+    _Atomic uint64_t opened; // when every slow connection was open, 0 before
+    _Atomic uint64_t end;    // a run's length after that
+} config_t;
+
+typedef struct {
+    config_t *cfg;
+    int id;
+    uint64_t seed;
+    samples_t before, during;
+    uint64_t failed, bytes;
+} client_t;
+
+typedef struct {
+    uint64_t opened, finished, refused;
+} slowstats_t;
+
+// a well-behaved client, timing requests for small objects
+//
+static void *run_client(void *arg) {
+    client_t *c = (client_t *) arg;
+    config_t *cfg = c->cfg;
+    char name[NAME_SIZE];
+    uint64_t sent, done, opened;
+    bool put;
+    int code;
+
+    while ((sent = now_ns()) < atomic_load(&cfg->end)) {
+        put = next_random(&c->seed) % 5 == 0;
+        snprintf(name, sizeof(name), "n%05d", (int) (next_random(&c->seed) % cfg->nkeys));
+        code = http_request(&cfg->addr, put ? "PUT" : "GET", name, c->id, cfg->body,
+            put ? cfg->putsize : 0, &c->bytes);
+        done = now_ns();
+        if (code != 200 && code != 201) {
+            c->failed++;
+            continue;
+        }
+
+        // requests sent while the slow connections were still opening
+        // count in neither half
+        opened = atomic_load(&cfg->opened);
+        if (sent < cfg->attack) {
+            add_sample(&c->before, done - sent);
+        } else if (opened != 0 && sent >= opened) {
+            add_sample(&c->during, done - sent);
+        }
+    }
+
+    return NULL;
+}
+
+static slowkind_t next_kind(config_t *cfg, uint64_t *state) {
+    unsigned pick = next_random(state) % (cfg->mix[0] + cfg->mix[1] + cfg->mix[2]);
+
+    if (pick < cfg->mix[SLOW_TRICKLE]) {
+        return SLOW_TRICKLE;
+    }
+
+    return pick < cfg->mix[SLOW_TRICKLE] + cfg->mix[SLOW_STALL] ? SLOW_STALL : SLOW_READ;
+}
+
+// opens a slow connection and writes out its request head. returns -1 if
+// the server could not be reached
+//
+static int open_slow(config_t *cfg, slowconn_t *sc, uint64_t now) {
+    int rcvbuf = RCVBUF;
+
+    sc->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sc->fd < 0) {
+        return -1;
+    }
+
+    if (sc->kind == SLOW_READ) {
+        setsockopt(sc->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    if (connect(sc->fd, (struct sockaddr *) &cfg->addr, sizeof(cfg->addr)) < 0) {
+        close(sc->fd);
+        sc->fd = -1;
+        return -1;
+    }
+    fcntl(sc->fd, F_SETFL, fcntl(sc->fd, F_GETFL) | O_NONBLOCK);
+
+    if (sc->kind == SLOW_READ) {
+        sc->hlen = snprintf(sc->head, HEAD_SIZE, "GET /%s HTTP/1.1\r\n\r\n", SLOW_OBJECT);
+    } else {
+        sc->hlen = snprintf(sc->head, HEAD_SIZE,
+            "PUT /s%06d HTTP/1.1\r\nContent-Length: %zu\r\n\r\n", sc->id, cfg->putsize);
+    }
+    sc->len = sc->hlen + (sc->kind == SLOW_READ ? 0 : cfg->putsize);
+    sc->pos = 0;
+    sc->next = now;
+    return 0;
+}
+
+static void close_slow(slowconn_t *sc) {
+    if (sc->fd >= 0) {
+        close(sc->fd);
+        sc->fd = -1;
+    }
+}
+
+// sends up to n more bytes of a slow connection's request
+//
+static void send_slow(config_t *cfg, slowconn_t *sc, size_t n) {
+    ssize_t nbytes;
+
+    while (n > 0 && sc->pos < sc->len) {
+        if (sc->pos < sc->hlen) {
+            nbytes = send(sc->fd, sc->head + sc->pos, MIN(n, sc->hlen - sc->pos), MSG_NOSIGNAL);
+        } else {
+            nbytes = send(sc->fd, cfg->body, MIN(n, sc->len - sc->pos), MSG_NOSIGNAL);
+        }
+        if (nbytes <= 0) {
+            return;
+        }
+
+        sc->pos += nbytes;
+        n -= nbytes;
+    }
+}
+
+// takes a slow connection one step further. returns true once the server
+// has answered and closed it
+//
+static bool step_slow(config_t *cfg, slowconn_t *sc, uint64_t now) {
+    char buf[RCVBUF];
+    ssize_t nbytes;
+
+    switch (sc->kind) {
+    case SLOW_TRICKLE: send_slow(cfg, sc, cfg->step); break;
+    case SLOW_STALL:
+        // half the body goes out at once, then the connection stalls until
+        // the run ends
+        if (sc->pos < sc->len) {
+            send_slow(cfg, sc, sc->hlen + cfg->putsize / 2 - sc->pos);
+            sc->next = cfg->end;
+            return false;
+        }
+        break;
+    case SLOW_READ: send_slow(cfg, sc, sc->len); break;
+    }
+
+    sc->next = now + cfg->interval;
+    if (sc->pos < sc->len) {
+        return false;
+    }
+
+    // slow readers take a few bytes of the response at a time, the others
+    // take the response whole
+    nbytes = recv(sc->fd, buf, sc->kind == SLOW_READ ? cfg->step : sizeof(buf), 0);
+    return nbytes == 0 || (nbytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+// keeps the slow connections going until the run ends, replacing those
+// that finish
+//
+static void run_slow(config_t *cfg, slowstats_t *stats) {
+    slowconn_t *conns = (slowconn_t *) calloc(cfg->nslow, sizeof(slowconn_t));
+    uint64_t seed = 0x2545f4914f6cdd1dULL, now, wake;
+    int nextid = 0;
+
+    if (conns == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+
+    sleep_until(cfg->attack);
+    for (int i = 0; i < cfg->nslow; i++) {
+        conns[i].kind = next_kind(cfg, &seed);
+        conns[i].id = nextid++;
+        if (open_slow(cfg, &conns[i], now_ns()) < 0) {
+            stats[conns[i].kind].refused++;
+            continue;
+        }
+        stats[conns[i].kind].opened++;
+    }
+    now = now_ns();
+    atomic_store(&cfg->opened, now);
+    atomic_store(&cfg->end, now + (uint64_t) (cfg->seconds * 1e9));
+
+    while ((now = now_ns()) < cfg->end) {
+        wake = cfg->end;
+        for (int i = 0; i < cfg->nslow; i++) {
+            slowconn_t *sc = &conns[i];
+
+            if (sc->fd >= 0 && sc->next <= now && step_slow(cfg, sc, now)) {
+                stats[sc->kind].finished++;
+                close_slow(sc);
+                sc->id = nextid++;
+                if (open_slow(cfg, sc, now) < 0) {
+                    stats[sc->kind].refused++;
+                } else {
+                    stats[sc->kind].opened++;
+                }
+            }
+
+            if (sc->fd >= 0 && sc->next < wake) {
+                wake = sc->next;
+            }
+        }
+
+        sleep_until(wake);
+    }
+
+    for (int i = 0; i < cfg->nslow; i++) {
+        close_slow(&conns[i]);
+    }
+    free(conns);
+}
+
+// puts the objects both kinds of clients GET
+//
+static void prefill(config_t *cfg) {
+    char name[NAME_SIZE];
+    uint64_t bytes = 0;
+
+    for (int key = 0; key < cfg->nkeys; key++) {
+        snprintf(name, sizeof(name), "n%05d", key);
+        if (http_request(&cfg->addr, "PUT", name, 0, cfg->body, cfg->putsize, &bytes) < 0) {
+            errx(EXIT_FAILURE, "prefilling /%s failed", name);
+        }
+    }
+
+    if (http_request(&cfg->addr, "PUT", SLOW_OBJECT, 0, cfg->body, cfg->getsize, &bytes) < 0) {
+        errx(EXIT_FAILURE, "prefilling /%s failed", SLOW_OBJECT);
+    }
+}
+
+// lets the process keep as many connections open as it may
+//
+static void raise_fd_limit(void) {
+    struct rlimit lim;
+
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+static void print_degradation(samples_t *before, samples_t *during) {
+    if (before->n == 0 || during->n == 0) {
+        return;
+    }
+
+    // print_latency() has sorted both
+    printf("slowdown p50 %.2fx p99 %.2fx p999 %.2fx\n",
+        percentile(during, 0.5) / percentile(before, 0.5),
+        percentile(during, 0.99) / percentile(before, 0.99),
+        percentile(during, 0.999) / percentile(before, 0.999));
+}
+
+static void usage(char *exec) {
+    fprintf(stderr,
+        "usage: %s [-c clients] [-d seconds] [-n slowconns] [-m trickle:stall:slowread] "
+        "[-i interval_ms] [-b step_bytes] [-p putsize] [-g getsize] [-h host] <port>\n",
+        exec);
+}
+
+int main(int argc, char *argv[]) {
+    config_t cfg = {
+        .nclients = 4,
+        .seconds = 10,
+        .nslow = 1000,
+        .mix = { 1, 1, 1 },
+        .interval = 10000000,
+        .step = 1,
+        .putsize = 256,
+        .getsize = 1 << 20,
+        .nkeys = 100,
+    };
+    slowstats_t stats[NKINDS] = { 0 };
+    samples_t before = { 0 }, during = { 0 };
+    uint64_t failed = 0;
+    char *host = "127.0.0.1";
+    client_t *clients;
+    pthread_t *threads;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:d:n:m:i:b:p:g:h:")) != -1) {
+        switch (opt) {
+        case 'c': cfg.nclients = atoi(optarg); break;
+        case 'd': cfg.seconds = atof(optarg); break;
+        case 'n': cfg.nslow = atoi(optarg); break;
+        case 'm':
+            if (sscanf(optarg, "%u:%u:%u", &cfg.mix[0], &cfg.mix[1], &cfg.mix[2]) != 3
+                || cfg.mix[0] + cfg.mix[1] + cfg.mix[2] == 0) {
+                errx(EXIT_FAILURE, "bad mix: %s", optarg);
+            }
+            break;
+        case 'i': cfg.interval = (uint64_t) (atof(optarg) * 1e6); break;
+        case 'b': cfg.step = strtoul(optarg, NULL, 10); break;
+        case 'p': cfg.putsize = strtoul(optarg, NULL, 10); break;
+        case 'g': cfg.getsize = strtoul(optarg, NULL, 10); break;
+        case 'h': host = optarg; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 || cfg.nclients <= 0 || cfg.seconds <= 0 || cfg.nslow < 0
+        || cfg.interval == 0 || cfg.step == 0 || cfg.step > RCVBUF || cfg.putsize > MAX_SIZE
+        || cfg.getsize > MAX_SIZE) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (parse_addr(host, argv[optind], &cfg.addr) < 0) {
+        errx(EXIT_FAILURE, "bad address: %s:%s", host, argv[optind]);
+    }
+
+    raise_fd_limit();
+    cfg.body = create_body();
+    prefill(&cfg);
+
+    clients = (client_t *) calloc(cfg.nclients, sizeof(client_t));
+    threads = (pthread_t *) calloc(cfg.nclients, sizeof(pthread_t));
+    if (clients == NULL || threads == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+
+    // the first half of the run is the baseline, the second the attack
+    cfg.start = now_ns();
+    cfg.attack = cfg.start + (uint64_t) (cfg.seconds * 1e9);
+    atomic_init(&cfg.opened, 0);
+    atomic_init(&cfg.end, UINT64_MAX);
+    for (int i = 0; i < cfg.nclients; i++) {
+        clients[i].cfg = &cfg;
+        clients[i].id = i;
+        clients[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+        if (pthread_create(&threads[i], NULL, run_client, &clients[i]) != 0) {
+            err(EXIT_FAILURE, "pthread_create");
+        }
+    }
+
+    run_slow(&cfg, stats);
+
+    for (int i = 0; i < cfg.nclients; i++) {
+        pthread_join(threads[i], NULL);
+        merge_samples(&before, &clients[i].before);
+        merge_samples(&during, &clients[i].during);
+        failed += clients[i].failed;
+        free_samples(&clients[i].before);
+        free_samples(&clients[i].during);
+    }
+
+    printf("clients %d duration %.1fs+%.1fs slow %d mix %u:%u:%u interval %.1fms step %zu\n",
+        cfg.nclients, cfg.seconds, cfg.seconds, cfg.nslow, cfg.mix[0], cfg.mix[1], cfg.mix[2],
+        cfg.interval / 1e6, cfg.step);
+    printf("slow connections opened in %.3fs\n", (atomic_load(&cfg.opened) - cfg.attack) / 1e9);
+    for (int k = 0; k < NKINDS; k++) {
+        printf("slow %-8s opened %-7" PRIu64 " finished %-7" PRIu64 " refused %" PRIu64 "\n",
+            kind_names[k], stats[k].opened, stats[k].finished, stats[k].refused);
+    }
+    printf("failed %" PRIu64 " throughput before %.1f req/s during %.1f req/s\n", failed,
+        before.n / cfg.seconds, during.n / cfg.seconds);
+    print_latency("before", &before);
+    print_latency("during", &during);
+    print_degradation(&before, &during);
+
+    free_samples(&before);
+    free_samples(&during);
+    free(cfg.body);
+    free(clients);
+    free(threads);
+    return EXIT_SUCCESS;
+}
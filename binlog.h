@@ -0,0 +1,44 @@
+#ifndef __BINLOG_H__
+#define __BINLOG_H__
+
+#include <stdint.h>
+
+// the binary request log. the file starts with BINLOG_MAGIC and is
+// followed by records in the byte order of the server that wrote it.
+// every record starts with a binlog_head_t:
+//
+// * a name record binds an object name to an id. the head holds the
+//   length of the name and its id, and the name follows it without a
+//   terminator. ids are reused once the writer forgets its names, a later
+//   name record for an id replaces the earlier one
+// * a request record is a fixed-size binlog_req_t. its head holds the
+//   method, the status and the id of the object, or BINLOG_NONAME for a
+//   request that was rejected before its object was parsed
+//
+// tools/logconvert turns a binary log back into the text log
+
+#define BINLOG_MAGIC     "HSBLOG01"
+#define BINLOG_MAGIC_LEN 8
+#define BINLOG_NONAME    UINT32_MAX
+
+typedef enum { BINLOG_NAME = 1, BINLOG_REQUEST = 2 } binlog_kind_t;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t method;
+    uint16_t value;
+    uint32_t nameid;
+} binlog_head_t;
+
+// value of the head is the status code. time is the wall-clock time the
+// request completed at and latency the time since its connection was
+// accepted, both in microseconds
+//
+typedef struct {
+    binlog_head_t head;
+    uint32_t reqid;
+    uint32_t latency;
+    uint64_t time;
+} binlog_req_t;
+
+#endif
@@ -0,0 +1,323 @@
+#include "filestore.h"
+#include "ioutil.h"
+#include "metaindex.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the default storage backend: every object is a file of the same name in
+// the working directory, or with sharding, in a directory two levels
+// below it picked by the hash of the name (see shard_path()). bodies are
+// staged in a tmpfile, which a PUT commits in place of the object and an
+// APPEND copies onto its end. with a metadata index, lookups are answered
+// from the index and only objects that exist are ever opened
+
+typedef struct {
+    store_t store;
+    metaindex_t *index;
+    bool sharded;
+} filestore_t;
+
+// returns the path of an object, which is its name unless the store is
+// sharded, in which case it is written to path
+//
+// fs  : file store
+// name: object name
+// path: buffer of at least SHARD_PATHSIZE bytes
+//
+static char *object_path(filestore_t *fs, char *name, char *path) {
+    if (fs->sharded == false) {
+        return name;
+    }
+
+    shard_path(name, path);
+    return path;
+}
+
+// syncs a directory, so that the entries made in it survive a crash.
+// returns 0 on success, -1 on failure
+//
+static int sync_dir(char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    int rc;
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// creates the directories of a sharded path that do not exist yet, and
+// syncs the parent of each one it creates so that the shard is as durable
+// as the commits that go on to sync it. returns 0 on success, -1 on failure
+//
+static int make_shard(char *path) {
+    char dir[SHARD_PREFIX];
+
+    memcpy(dir, path, SHARD_PREFIX - 1);
+    dir[2] = '\0';
+    if (mkdir(dir, 0755) == 0) {
+        if (sync_dir(".") < 0) {
+            return -1;
+        }
+    } else if (errno != EEXIST) {
+        return -1;
+    }
+
+    dir[SHARD_PREFIX - 1] = '\0';
+    dir[2] = '/';
+    if (mkdir(dir, 0755) == 0) {
+        dir[2] = '\0';
+        if (sync_dir(dir) < 0) {
+            return -1;
+        }
+    } else if (errno != EEXIST) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// looks an object up in the index the way stat_path() would. returns 0
+// on success, or -1 and updates status if there is no such object or it
+// is a directory
+//
+static int lookup_file(metaindex_t *index, char *name, struct stat *statbuf, status_t *status) {
+    if (metaindex_lookup(index, name, statbuf) == false) {
+        *status = FILE_NOT_FOUND;
+        return -1;
+    }
+
+    if (S_ISDIR(statbuf->st_mode) != 0) {
+        *status = FORBIDDEN;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int filestore_open(
+    store_t *store, char *name, struct stat *statbuf, off_t *base, status_t *status) {
+    filestore_t *fs = (filestore_t *) store;
+    char buf[SHARD_PATHSIZE], *path = object_path(fs, name, buf);
+    int fd;
+
+    *base = 0;
+    if (fs->index != NULL) {
+        if (lookup_file(fs->index, name, statbuf, status) < 0) {
+            return -1;
+        }
+
+        return open_file(path, O_RDONLY, status);
+    }
+
+    fd = open_file(path, O_RDONLY, status);
+    if (fd >= 0 && stat_file(fd, statbuf, status) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int filestore_stat(store_t *store, char *name, struct stat *statbuf, status_t *status) {
+    filestore_t *fs = (filestore_t *) store;
+    char buf[SHARD_PATHSIZE];
+
+    if (fs->index != NULL) {
+        return lookup_file(fs->index, name, statbuf, status);
+    }
+
+    return stat_path(object_path(fs, name, buf), statbuf, status);
+}
+
+static int filestore_check(store_t *store, request_t *req) {
+    filestore_t *fs = (filestore_t *) store;
+    char buf[SHARD_PATHSIZE];
+    struct stat statbuf;
+    int fd;
+
+    // objects the index has never seen are answered without a syscall,
+    // the others are opened to find out if they can be written
+    if (fs->index != NULL && metaindex_lookup(fs->index, req->reqline.object, &statbuf) == false) {
+        if (req->reqline.method == PUT) {
+            req->object.status = CREATED;
+            return 0;
+        }
+
+        req->status = FILE_NOT_FOUND;
+        return -1;
+    }
+
+    fd = open_file(object_path(fs, req->reqline.object, buf), O_APPEND | O_WRONLY, &req->status);
+    if (fd < 0) {
+        if (req->reqline.method == PUT && req->status == FILE_NOT_FOUND) {
+            req->status = OK;
+            req->object.status = CREATED;
+            return 0;
+        }
+
+        return -1;
+    }
+
+    if (file_is_dir(fd, &req->status) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int filestore_stage(store_t *store, request_t *req) {
+    (void) store;
+
+    req->tmp.fd = create_tmpfile(req->tmp.name, &req->status);
+    if (req->tmp.fd < 0) {
+        return -1;
+    }
+
+    // an APPEND copies its body out by descriptor, only a PUT needs the
+    // name of a named tmpfile to commit it
+    if (req->reqline.method == APPEND && req->tmp.name[0] != '\0') {
+        unlink(req->tmp.name);
+        req->tmp.name[0] = '\0';
+    }
+
+    // claim the space for the body before accepting any of it
+    if (reserve_file(req->tmp.fd, 0, req->fields.contlen, &req->status) < 0) {
+        if (req->tmp.name[0] != '\0') {
+            unlink(req->tmp.name);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+// records the metadata of a committed object in the index
+//
+static int index_file(filestore_t *fs, request_t *req) {
+    struct stat statbuf;
+
+    if (stat_file(req->object.fd, &statbuf, &req->status) < 0) {
+        return -1;
+    }
+
+    if (metaindex_update(fs->index, req->reqline.object, &statbuf) < 0) {
+        req->status = INT_ERR;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int filestore_commit(store_t *store, request_t *req) {
+    filestore_t *fs = (filestore_t *) store;
+    char buf[SHARD_PATHSIZE], *path = object_path(fs, req->reqline.object, buf);
+    int rc = 0;
+
+    if (req->reqline.method == PUT) {
+        // the shard of an object is only made once something is put in it
+        if (fs->sharded && req->object.status == CREATED && make_shard(path) < 0) {
+            req->status = INT_ERR;
+            return -1;
+        }
+
+        if (commit_tmpfile(req->tmp.fd, req->tmp.name, path, &req->object.status) < 0) {
+            req->status = req->object.status;
+            return -1;
+        }
+
+        // the tmpfile is the object now, and its entry is in the shard
+        req->object.fd = req->tmp.fd;
+        req->tmp.fd = -1;
+        if (fs->sharded) {
+            memcpy(req->durable.dir, path, SHARD_PREFIX - 1);
+            req->durable.dir[SHARD_PREFIX - 1] = '\0';
+        } else {
+            strcpy(req->durable.dir, ".");
+        }
+        rc = 1;
+    } else {
+        req->object.fd = open_file(path, O_WRONLY, &req->status);
+        if (req->object.fd < 0) {
+            return -1;
+        }
+
+        append_file(req->tmp.fd, req->object.fd, req->object.size);
+    }
+
+    if (fs->index != NULL && index_file(fs, req) < 0) {
+        return -1;
+    }
+
+    return rc;
+}
+
+static int filestore_refresh(store_t *store, char *name) {
+    filestore_t *fs = (filestore_t *) store;
+    char buf[SHARD_PATHSIZE];
+    struct stat statbuf;
+    status_t status = OK;
+
+    if (fs->index == NULL) {
+        return 0;
+    }
+
+    if (stat_path(object_path(fs, name, buf), &statbuf, &status) < 0
+        || metaindex_update(fs->index, name, &statbuf) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int filestore_openw(store_t *store, char *name, status_t *status) {
+    filestore_t *fs = (filestore_t *) store;
+    char buf[SHARD_PATHSIZE];
+
+    return open_file(object_path(fs, name, buf), O_RDWR, status);
+}
+
+static void filestore_destroy(store_t *store) {
+    filestore_t *fs = (filestore_t *) store;
+
+    metaindex_destroy(&fs->index);
+    free(fs);
+}
+
+static const storeops_t filestore_ops = {
+    .open = filestore_open,
+    .stat = filestore_stat,
+    .check = filestore_check,
+    .stage = filestore_stage,
+    .commit = filestore_commit,
+    .refresh = filestore_refresh,
+    .openw = filestore_openw,
+    .destroy = filestore_destroy,
+};
+
+// creates a file store, which takes over the metadata index if there is one
+//
+// index  : metadata index of the working directory, or NULL
+// sharded: whether objects are kept in hashed subdirectories
+//
+store_t *filestore_create(metaindex_t *index, bool sharded) {
+    filestore_t *fs = (filestore_t *) malloc(sizeof(filestore_t));
+    if (fs == NULL) {
+        return NULL;
+    }
+
+    fs->store.ops = &filestore_ops;
+    fs->index = index;
+    fs->sharded = sharded;
+    return &fs->store;
+}
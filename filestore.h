@@ -0,0 +1,9 @@
+#ifndef __FILESTORE_H__
+#define __FILESTORE_H__
+
+#include "metaindex.h"
+#include "store.h"
+
+store_t *filestore_create(metaindex_t *index, bool sharded);
+
+#endif
@@ -1,8 +1,20 @@
+#include "appender.h"
 #include "connection.h"
 #include "debug.h"
+#include "filestore.h"
 #include "ioutil.h"
+#include "locktable.h"
+#include "logger.h"
+#include "logstore.h"
+#include "metaindex.h"
+#include "metrics.h"
+#include "probe.h"
+#include "stats.h"
+#include "mmapcache.h"
 #include "request.h"
 #include "status.h"
+#include "store.h"
+#include "syncer.h"
 #include "util.h"
 #include "queue.h"
 #include "connpoll.h"
@@ -23,20 +35,34 @@
 #include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define OPTIONS              "t:l:"
-#define DEFAULT_THREAD_COUNT 4
+#define OPTIONS               "t:l:m:d:is:xHn:f:M:S"
+#define DEFAULT_THREAD_COUNT  4
+#define DEFAULT_MMAP_SLOTS    1024
+#define DEFAULT_LOCK_STRIPES  256
+#define DEFAULT_SYNC_WINDOW   1000
+#define DEFAULT_APPEND_SLOTS  256
+#define DEFAULT_SEGMENT_SIZE  (64 << 20)
+#define DEFAULT_INDEX_BUCKETS 4096
+#define DEFAULT_LOG_SLOTS     4096
 
 static FILE *logfile;
-#define LOG(...) fprintf(logfile, __VA_ARGS__);
 
 threadpool_t *thread_pool;
 map_t *connection_map;
 pthread_mutex_t maplock;
 connpoll_t *connection_poll;
-pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+mmapcache_t *mmap_cache;
+syncer_t *syncer;
+locktable_t *file_locks;
+appender_t *appender;
+logger_t *request_logger;
+metrics_t *metrics;
+stats_t *stats;
+store_t *store;
 
 // Creates a socket for listening for connections.
 // Closes the program and prints an error message on error.
@@ -45,10 +71,14 @@ pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
 //
 static int create_listen_socket(uint16_t port) {
     struct sockaddr_in addr;
+    int on = 1;
     int listenfd = socket(AF_INET, SOCK_STREAM, 0);
     if (listenfd < 0) {
         err(EXIT_FAILURE, "socket error");
     }
+    // the server closes every connection first, so a restart would otherwise
+    // wait out the TIME_WAIT of the last ones
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
     memset(&addr, 0, sizeof addr);
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htons(INADDR_ANY);
@@ -62,15 +92,122 @@ static int create_listen_socket(uint16_t port) {
     return listenfd;
 }
 
+// logs a request. callers hold the request's object lock, which orders the
+// log lines of each object. the line is written by the logger's writer
+// thread. the status is also the one the request's latency is counted under
+//
+// req   : pointer to request struct
+// status: status code the request completed with
+//
 void log_request(request_t *req, status_t status) {
-    switch (req->reqline.method) {
-    case GET: LOG(GET_LOG_MSG, req->reqline.object, status, req->fields.reqid); break;
-    case PUT: LOG(PUT_LOG_MSG, req->reqline.object, status, req->fields.reqid); break;
-    case APPEND: LOG(APPEND_LOG_MSG, req->reqline.object, status, req->fields.reqid); break;
-    default: break;
+    logger_log(request_logger, req, status);
+    req->timing.result = status;
+}
+
+// checks the state of a request. when the request has moved on since the
+// last check the transition is traced, and with metrics the time it spent
+// in its previous state is recorded
+//
+// conn : connection of the request
+// state: state to check for
+//
+static inline bool in_state(connection_t *conn, state_t state) {
+    if (conn->req.state != conn->req.timing.state) {
+        PROBE3(state, conn->connfd, conn->req.timing.state, conn->req.state);
+        if (metrics != NULL) {
+            metrics_track(metrics, &conn->req);
+        } else {
+            conn->req.timing.state = conn->req.state;
+        }
     }
 
-    fflush(logfile);
+    return conn->req.state == state;
+}
+
+// takes the write lock of an object for a commit, first demoting the
+// in-place APPEND streaming into the object if there is one. returns 0
+// with the lock held, or -1 with it released if the bytes of the in-place
+// APPEND could not be moved out of the object
+//
+// name: object name
+//
+static int lock_for_commit(char *name) {
+    int rc;
+
+    locktable_wrlock(file_locks, name);
+    while (appender != NULL && (rc = appender_demote(appender, name)) <= 0) {
+        locktable_unlock(file_locks, name);
+        if (rc < 0) {
+            return -1;
+        }
+
+        // the in-place writer is being serviced, it suspends or commits soon
+        appender_wait(appender, name);
+        locktable_wrlock(file_locks, name);
+    }
+
+    return 0;
+}
+
+// copies the metadata of an object into the request, hiding the bytes and
+// the mtime of an in-place APPEND that has not committed yet
+//
+// req    : pointer to request struct
+// statbuf: the object's metadata
+//
+static void set_object_meta(request_t *req, struct stat *statbuf) {
+    if (appender != NULL) {
+        appender_clamp(appender, req->reqline.object, statbuf);
+    }
+
+    req->object.size = statbuf->st_size;
+    req->object.ino = statbuf->st_ino;
+    req->object.mtime = statbuf->st_mtim;
+}
+
+// hands a connection that suspended in SYNC_BODY to the syncer
+//
+// conn: pointer to connection struct
+//
+static void sync_connection(connection_t *conn) {
+    syncer_commit(syncer, conn->req.durable.fd, conn->req.durable.dir, conn);
+}
+
+// queues a connection for a worker again once the syncer is done with its
+// commit
+//
+// waiter: the connection
+// failed: whether the commit could not be synced
+//
+static void resume_synced(void *waiter, bool failed) {
+    connection_t *conn = (connection_t *) waiter;
+
+    conn->req.durable.synced = true;
+    conn->req.durable.failed = failed;
+    PROBE1(resume, conn->connfd);
+    threadpool_add_connection(thread_pool, conn);
+}
+
+// holds the response to a commit until the commit is durable. the first
+// time through the request suspends, and the worker hands it to the syncer
+// instead of waiting. returns false while the request is suspended, and
+// true once it can be answered, with status set to INT_ERR if the sync
+// failed
+//
+// conn  : pointer to connection struct
+// status: status code the response is sent with
+//
+static bool wait_durable(connection_t *conn, status_t *status) {
+    if (syncer != NULL && conn->req.durable.synced == false) {
+        conn->req.status = SUSPEND;
+        return false;
+    }
+
+    if (conn->req.durable.failed) {
+        *status = INT_ERR;
+    }
+
+    return true;
 }
 
 // GET request handler for http server. Updates a status code througout
@@ -81,44 +218,85 @@ void log_request(request_t *req, status_t status) {
 // status: status code tracking request status
 //
 void handle_get(connection_t *conn) {
-    if (conn->req.state == HANDLE_REQUEST) {
-        pthread_mutex_lock(&file_lock);
-        conn->req.object.fd = open_file(conn->req.reqline.object, O_RDONLY, &conn->req.status);
-        if (conn->req.object.fd < 0) {
+    if (in_state(conn, HANDLE_REQUEST)) {
+        struct stat statbuf;
+        uint64_t gen = 0;
+
+        locktable_rdlock(file_locks, conn->req.reqline.object);
+        if (mmap_cache != NULL) {
+            conn->req.object.map = mmapcache_lookup(mmap_cache, conn->req.reqline.object, &gen);
+        }
+
+        if (conn->req.object.map != NULL) {
+            conn->req.object.size = conn->req.object.map->size;
+            conn->req.object.ino = conn->req.object.map->ino;
+            conn->req.object.mtime = conn->req.object.map->mtime;
+        } else {
+            // a conditional GET of an object that has not changed is
+            // answered from its metadata without opening it
+            if ((conn->req.fields.etags != NULL || conn->req.fields.since >= 0)
+                && store_stat(store, conn->req.reqline.object, &statbuf, &conn->req.status) == 0) {
+                set_object_meta(&conn->req, &statbuf);
+                evaluate_http_conditions(&conn->req);
+            }
+
+            if (conn->req.status == OK && conn->req.object.status != NOT_MODIFIED) {
+                conn->req.object.fd = store_open(store, conn->req.reqline.object, &statbuf,
+                    &conn->req.object.base, &conn->req.status);
+                if (conn->req.object.fd >= 0) {
+                    set_object_meta(&conn->req, &statbuf);
+                }
+            }
+        }
+
+        if (conn->req.status == OK) {
+            evaluate_http_conditions(&conn->req);
+            if (conn->req.object.status != NOT_MODIFIED) {
+                resolve_http_range(&conn->req);
+            }
+        }
+
+        if (conn->req.status != OK) {
             log_request(&conn->req, conn->req.status);
-            pthread_mutex_unlock(&file_lock);
+            locktable_unlock(file_locks, conn->req.reqline.object);
             send_http_response(conn->connfd, &conn->req, conn->req.status);
             return;
         }
 
-        log_request(&conn->req, conn->req.status);
-        pthread_mutex_unlock(&file_lock);
+        log_request(&conn->req, conn->req.object.status);
+        locktable_unlock(file_locks, conn->req.reqline.object);
 
-        if (file_is_dir(conn->req.object.fd, &conn->req.status) != 0) {
-            send_http_response(conn->connfd, &conn->req, conn->req.status);
+        if (conn->req.object.status == NOT_MODIFIED) {
+            send_http_response(conn->connfd, &conn->req, conn->req.object.status);
+            conn->req.state = DONE;
             return;
         }
 
-        conn->req.fields.contlen = sizeof_file(conn->req.object.fd, &conn->req.status);
-        if (conn->req.fields.contlen < 0) {
-            send_http_response(conn->connfd, &conn->req, conn->req.status);
-            return;
+        // map the object for this and later readers if it is small enough
+        if (conn->req.object.map == NULL && mmap_cache != NULL) {
+            conn->req.object.map = mmapcache_insert(
+                mmap_cache, conn->req.reqline.object, conn->req.object.fd, &statbuf, gen);
         }
 
         conn->req.state = SEND_ACK;
     }
 
     // send OK to client before sending contents
-    if (conn->req.state == SEND_ACK) {
-        if (send_http_response(conn->connfd, &conn->req, conn->req.status) < 0) {
+    if (in_state(conn, SEND_ACK)) {
+        if (send_http_response(conn->connfd, &conn->req, conn->req.object.status) < 0) {
             return;
         }
 
-        conn->req.fields.contlen = 0;
+        if (conn->req.object.map != NULL) {
+            conn->req.object.zerocopy = enable_zerocopy(conn->connfd);
+        } else {
+            set_nonblocking(conn->connfd);
+        }
+
         conn->req.state = SEND_BODY;
     }
 
-    if (conn->req.state == SEND_BODY) {
+    if (in_state(conn, SEND_BODY)) {
         if (send_http_body(conn->connfd, &conn->req) < 0) {
             if (conn->req.status == SUSPEND) {
                 return;
@@ -129,6 +307,47 @@ void handle_get(connection_t *conn) {
     }
 }
 
+// HEAD request handler for http server. Sends the same header fields as
+// a GET without the body, taken from a cached mapping of the object if
+// there is one or from stat() otherwise, so the object is never opened
+//
+// conn: pointer to connection struct
+//
+void handle_head(connection_t *conn) {
+    struct stat statbuf;
+    mapping_t *map = NULL;
+    uint64_t gen = 0;
+
+    locktable_rdlock(file_locks, conn->req.reqline.object);
+    if (mmap_cache != NULL) {
+        map = mmapcache_lookup(mmap_cache, conn->req.reqline.object, &gen);
+    }
+
+    if (map != NULL) {
+        conn->req.object.size = map->size;
+        conn->req.object.ino = map->ino;
+        conn->req.object.mtime = map->mtime;
+        mapping_release(&map);
+    } else if (store_stat(store, conn->req.reqline.object, &statbuf, &conn->req.status) == 0) {
+        set_object_meta(&conn->req, &statbuf);
+    }
+
+    if (conn->req.status != OK) {
+        log_request(&conn->req, conn->req.status);
+        locktable_unlock(file_locks, conn->req.reqline.object);
+        send_http_response(conn->connfd, &conn->req, conn->req.status);
+        return;
+    }
+
+    evaluate_http_conditions(&conn->req);
+    conn->req.fields.contlen = conn->req.object.size;
+    log_request(&conn->req, conn->req.object.status);
+    locktable_unlock(file_locks, conn->req.reqline.object);
+
+    send_http_response(conn->connfd, &conn->req, conn->req.object.status);
+    conn->req.state = DONE;
+}
+
 // PUT request handler for http server. Updates a status code througout
 // the request to reflect its success or failure
 //
@@ -137,37 +356,36 @@ void handle_get(connection_t *conn) {
 // status: status code tracking request status
 //
 void handle_put(connection_t *conn) {
-    if (conn->req.state == HANDLE_REQUEST) {
-        int fd;
-
-        fd = open_file(conn->req.reqline.object, O_APPEND | O_WRONLY, &conn->req.status);
-        if (fd < 0) {
-            if (conn->req.status == FILE_NOT_FOUND) {
-                conn->req.object.status = CREATED;
-            } else {
-                send_http_response(conn->connfd, &conn->req, conn->req.status);
-                return;
-            }
+    if (in_state(conn, HANDLE_REQUEST)) {
+        if (store_check(store, &conn->req) < 0) {
+            send_http_response(conn->connfd, &conn->req, conn->req.status);
+            return;
         }
 
-        if (conn->req.object.status != CREATED && file_is_dir(fd, &conn->req.status) != 0) {
+        if (store_stage(store, &conn->req) < 0) {
+            log_request(&conn->req, conn->req.status);
             send_http_response(conn->connfd, &conn->req, conn->req.status);
-            close(fd);
             return;
         }
 
-        if (fd > 2) {
-            close(fd);
+        // only now is a client waiting on "Expect: 100-continue" sent on.
+        // if it is gone the request is logged as failed
+        if (send_http_continue(conn->connfd, &conn->req) < 0) {
+            log_request(&conn->req, INT_ERR);
+            if (conn->req.tmp.name[0] != '\0') {
+                unlink(conn->req.tmp.name);
+            }
+            return;
         }
-        conn->req.tmp.fd = create_tmpfile(conn->req.tmp.name, &conn->req.status);
+
         conn->req.state = RECV_REM_BODY;
     }
 
-    if (conn->req.state == RECV_REM_BODY) {
-        recv_rem_http_body(&conn->req);
+    if (in_state(conn, RECV_REM_BODY)) {
+        recv_rem_http_body(conn->connfd, &conn->req);
     }
 
-    if (conn->req.state == RECV_BODY) {
+    if (in_state(conn, RECV_BODY)) {
         if (recv_http_body(conn->connfd, &conn->req) < 0) {
             if (conn->req.status == SUSPEND) {
                 return;
@@ -178,22 +396,76 @@ void handle_put(connection_t *conn) {
         }
     }
 
-    if (conn->req.state == WRITE_BODY) {
-        pthread_mutex_lock(&file_lock);
-        if (unlink(conn->req.reqline.object) == 0) {
-            conn->req.object.status = OK;
+    if (in_state(conn, WRITE_BODY)) {
+        if (lock_for_commit(conn->req.reqline.object) < 0) {
+            conn->req.object.status = INT_ERR;
+            log_request(&conn->req, conn->req.object.status);
+            send_http_response(conn->connfd, &conn->req, conn->req.object.status);
+            return;
+        }
+
+        if (store_commit(store, &conn->req) < 0) {
+            log_request(&conn->req, conn->req.status);
+            locktable_unlock(file_locks, conn->req.reqline.object);
+            send_http_response(conn->connfd, &conn->req, conn->req.status);
+            return;
+        }
+
+        if (mmap_cache != NULL) {
+            mmapcache_invalidate(mmap_cache, conn->req.reqline.object);
         }
-        rename(conn->req.tmp.name, conn->req.reqline.object);
         log_request(&conn->req, conn->req.object.status);
-        pthread_mutex_unlock(&file_lock);
+        locktable_unlock(file_locks, conn->req.reqline.object);
+
+        // hold the response until the new version is durable
+        conn->req.durable.fd = conn->req.object.fd;
+        conn->req.state = SYNC_BODY;
+    }
+
+    if (in_state(conn, SYNC_BODY)) {
+        if (wait_durable(conn, &conn->req.object.status) == false) {
+            return;
+        }
+
         conn->req.state = DONE;
     }
 
-    if (conn->req.state == DONE) {
+    if (in_state(conn, DONE)) {
         send_http_response(conn->connfd, &conn->req, conn->req.object.status);
     }
 }
 
+// makes an APPEND the in-place writer of its object if the object has
+// none, so that its body is received straight into the object past the
+// published length instead of into a tmpfile. returns false if the APPEND
+// has to be staged
+//
+// req: pointer to request struct
+//
+static bool claim_in_place(request_t *req) {
+    struct stat statbuf;
+    status_t status = OK;
+    int fd;
+
+    locktable_wrlock(file_locks, req->reqline.object);
+    fd = store_openw(store, req->reqline.object, &status);
+    if (fd >= 0 && stat_file(fd, &statbuf, &status) == 0
+        && lseek(fd, statbuf.st_size, SEEK_SET) >= 0) {
+        req->tmp.slot = appender_claim(appender, req->reqline.object, fd, &statbuf);
+    }
+    locktable_unlock(file_locks, req->reqline.object);
+
+    if (req->tmp.slot == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    req->tmp.fd = fd;
+    return true;
+}
+
 // APPEND request handler for http server. Updates a status code througout
 // the request to reflect its success or failure
 //
@@ -202,41 +474,56 @@ void handle_put(connection_t *conn) {
 // status: status code tracking request status
 //
 void handle_append(connection_t *conn) {
-    int fd;
 
-    if (conn->req.state == HANDLE_REQUEST) {
-        pthread_mutex_lock(&file_lock);
-        fd = open_file(conn->req.reqline.object, O_APPEND | O_WRONLY, &conn->req.status);
-        if (fd < 0) {
+    // an in-place APPEND may have been demoted to a staged one while it
+    // was suspended, its body is in a tmpfile from then on
+    if (conn->req.tmp.slot != NULL && appendslot_enter(conn->req.tmp.slot) == false) {
+        appendslot_release(&conn->req.tmp.slot);
+    }
+
+    if (in_state(conn, HANDLE_REQUEST)) {
+        locktable_rdlock(file_locks, conn->req.reqline.object);
+        if (store_check(store, &conn->req) < 0) {
             log_request(&conn->req, conn->req.status);
-            pthread_mutex_unlock(&file_lock);
+            locktable_unlock(file_locks, conn->req.reqline.object);
             send_http_response(conn->connfd, &conn->req, conn->req.status);
             return;
         }
-        pthread_mutex_unlock(&file_lock);
+        locktable_unlock(file_locks, conn->req.reqline.object);
 
-        if (file_is_dir(fd, &conn->req.status) != 0) {
-            send_http_response(conn->connfd, &conn->req, conn->req.status);
+        conn->req.object.size = conn->req.fields.contlen;
+        if ((appender == NULL || claim_in_place(&conn->req) == false)
+            && store_stage(store, &conn->req) < 0) {
             log_request(&conn->req, conn->req.status);
-            close(fd);
+            send_http_response(conn->connfd, &conn->req, conn->req.status);
             return;
         }
 
-        if (fd > 2) {
-            close(fd);
+        // only now is a client waiting on "Expect: 100-continue" sent on.
+        // if it is gone the request is logged as failed, and an in-place
+        // APPEND lets go of its slot lock so that destroying the request
+        // can abort it
+        if (send_http_continue(conn->connfd, &conn->req) < 0) {
+            log_request(&conn->req, INT_ERR);
+            if (conn->req.tmp.slot != NULL) {
+                appendslot_leave(conn->req.tmp.slot);
+            }
+            return;
         }
-        conn->req.tmp.fd = create_tmpfile(conn->req.tmp.name, &conn->req.status);
-        unlink(conn->req.tmp.name);
-        conn->req.object.size = conn->req.fields.contlen;
+
         conn->req.state = RECV_REM_BODY;
     }
 
-    if (conn->req.state == RECV_REM_BODY) {
-        recv_rem_http_body(&conn->req);
+    if (in_state(conn, RECV_REM_BODY)) {
+        recv_rem_http_body(conn->connfd, &conn->req);
     }
 
-    if (conn->req.state == RECV_BODY) {
+    if (in_state(conn, RECV_BODY)) {
         if (recv_http_body(conn->connfd, &conn->req) < 0) {
+            if (conn->req.tmp.slot != NULL) {
+                appendslot_leave(conn->req.tmp.slot);
+            }
+
             if (conn->req.status == SUSPEND) {
                 return;
             }
@@ -246,36 +533,77 @@ void handle_append(connection_t *conn) {
         }
     }
 
-    //uint8_t buffer[BLOCK] = { 0 };
-    //int nbytes = 0;
+    // the body of an in-place APPEND is already in the object, committing
+    // it only publishes the new length
+    if (in_state(conn, WRITE_BODY) && conn->req.tmp.slot != NULL) {
+        locktable_wrlock(file_locks, conn->req.reqline.object);
+        if (appendslot_publish(&conn->req.tmp.slot) < 0
+            || store_refresh(store, conn->req.reqline.object) < 0) {
+            conn->req.status = INT_ERR;
+        }
 
-    if (conn->req.state == WRITE_BODY) {
-        pthread_mutex_lock(&file_lock);
-        conn->req.object.fd = open_file(conn->req.reqline.object, O_WRONLY, &conn->req.status);
-        if (conn->req.object.fd < 0) {
-            pthread_mutex_unlock(&file_lock);
+        if (mmap_cache != NULL) {
+            mmapcache_invalidate(mmap_cache, conn->req.reqline.object);
+        }
+
+        log_request(&conn->req, conn->req.status);
+        locktable_unlock(file_locks, conn->req.reqline.object);
+
+        conn->req.durable.fd = conn->req.tmp.fd;
+        conn->req.state = SYNC_BODY;
+    }
+
+    if (in_state(conn, WRITE_BODY)) {
+        if (lock_for_commit(conn->req.reqline.object) < 0) {
+            conn->req.status = INT_ERR;
+            log_request(&conn->req, conn->req.status);
+            send_http_response(conn->connfd, &conn->req, conn->req.status);
+            return;
+        }
+
+        // a chunked body is only sized once its last chunk is decoded
+        if (conn->req.fields.chunked) {
+            conn->req.object.size = conn->req.chunk.total;
+        }
+
+        if (store_commit(store, &conn->req) < 0) {
+            log_request(&conn->req, conn->req.status);
+            locktable_unlock(file_locks, conn->req.reqline.object);
             send_http_response(conn->connfd, &conn->req, conn->req.status);
             return;
         }
 
-        append_file(conn->req.tmp.fd, conn->req.object.fd, conn->req.object.size);
+        if (mmap_cache != NULL) {
+            mmapcache_invalidate(mmap_cache, conn->req.reqline.object);
+        }
 
         log_request(&conn->req, conn->req.status);
-        pthread_mutex_unlock(&file_lock);
+        locktable_unlock(file_locks, conn->req.reqline.object);
+
+        conn->req.durable.fd = conn->req.object.fd;
+        conn->req.state = SYNC_BODY;
+    }
+
+    // hold the response until the appended data is durable
+    if (in_state(conn, SYNC_BODY)) {
+        if (wait_durable(conn, &conn->req.status) == false) {
+            return;
+        }
+
         conn->req.state = DONE;
     }
 
-    if (conn->req.state == DONE) {
+    if (in_state(conn, DONE)) {
         send_http_response(conn->connfd, &conn->req, conn->req.status);
     }
 }
 
 void handle_connection(connection_t *conn) {
-    if (conn->req.state == RECV_HEADER) {
+    if (in_state(conn, RECV_HEADER)) {
         recv_http_request(conn->connfd, &conn->req);
     }
 
-    if (conn->req.state == PARSE_HEADER) {
+    if (in_state(conn, PARSE_HEADER)) {
         parse_http_request(&conn->req);
     }
 
@@ -284,6 +612,7 @@ void handle_connection(connection_t *conn) {
         case GET: handle_get(conn); break;
         case PUT: handle_put(conn); break;
         case APPEND: handle_append(conn); break;
+        case HEAD: handle_head(conn); break;
         default: break;
         }
     } else if (conn->req.status != SUSPEND) {
@@ -295,22 +624,45 @@ void handle_connection(connection_t *conn) {
 static void sigterm_handler(int sig) {
     if (sig == SIGTERM) {
         warnx("received SIGTERM");
-        fclose(logfile);
         threadpool_destroy(&thread_pool);
         redblack_destroy(&connection_map);
         connpoll_destroy(&connection_poll);
+        mmapcache_destroy(&mmap_cache);
+        locktable_destroy(&file_locks);
+        syncer_destroy(&syncer);
+        appender_destroy(&appender);
+        store_destroy(&store);
+        metrics_destroy(&metrics);
+        stats_destroy(&stats);
+        logger_destroy(&request_logger);
+        fclose(logfile);
         pthread_mutex_destroy(&maplock);
         exit(EXIT_SUCCESS);
     }
 }
 
 static void usage(char *exec) {
-    fprintf(stderr, "usage: %s [-t threads] [-l logfile] <port>\n", exec);
+    fprintf(stderr,
+        "usage: %s [-t threads] [-l logfile] [-m mmapsize] [-d none|request|group] [-i] "
+        "[-s file|log] [-x] [-H] "
+        "[-n maxname] [-f text|binary] [-M metricsport] [-S] <port>\n",
+        exec);
 }
 
 int main(int argc, char *argv[]) {
     int opt = 0;
     int threads = DEFAULT_THREAD_COUNT;
+    int64_t mmapsize = 0;
+    syncmode_t syncmode = SYNC_NONE;
+    bool inplace = false;
+    bool logstore = false;
+    bool indexed = false;
+    bool sharded = false;
+    int64_t maxname = DEFAULT_OBJECT_LEN;
+    bool binarylog = false;
+    uint16_t metricsport = 0;
+    bool shared = false;
+    metaindex_t *index = NULL;
     logfile = stderr;
 
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
@@ -327,6 +679,57 @@ int main(int argc, char *argv[]) {
                 errx(EXIT_FAILURE, "bad logfile");
             }
             break;
+        case 'm':
+            mmapsize = strtoint64u(optarg);
+            if (mmapsize <= 0) {
+                errx(EXIT_FAILURE, "bad mmap size");
+            }
+            break;
+        case 'd':
+            if (strcmp(optarg, "none") == 0) {
+                syncmode = SYNC_NONE;
+            } else if (strcmp(optarg, "request") == 0) {
+                syncmode = SYNC_REQUEST;
+            } else if (strcmp(optarg, "group") == 0) {
+                syncmode = SYNC_GROUP;
+            } else {
+                errx(EXIT_FAILURE, "bad durability mode: %s", optarg);
+            }
+            break;
+        case 'i': inplace = true; break;
+        case 'S': shared = true; break;
+        case 'x': indexed = true; break;
+        case 'H': sharded = true; break;
+        case 'n':
+            maxname = strtoint64u(optarg);
+            if (maxname <= 0) {
+                errx(EXIT_FAILURE, "bad object name length");
+            }
+            break;
+        case 's':
+            if (strcmp(optarg, "file") == 0) {
+                logstore = false;
+            } else if (strcmp(optarg, "log") == 0) {
+                logstore = true;
+            } else {
+                errx(EXIT_FAILURE, "bad store: %s", optarg);
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "text") == 0) {
+                binarylog = false;
+            } else if (strcmp(optarg, "binary") == 0) {
+                binarylog = true;
+            } else {
+                errx(EXIT_FAILURE, "bad log format: %s", optarg);
+            }
+            break;
+        case 'M':
+            metricsport = strtouint16(optarg);
+            if (metricsport == 0) {
+                errx(EXIT_FAILURE, "bad metrics port: %s", optarg);
+            }
+            break;
         default: usage(argv[0]); return EXIT_FAILURE;
         }
     }
@@ -337,6 +740,28 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    // the mmap cache and in-place APPENDs work on the files of the objects
+    if (logstore && (mmapsize > 0 || inplace)) {
+        errx(EXIT_FAILURE, "-m and -i need the file store");
+    }
+
+    // the log store always keeps its own index and has no directories
+    if (logstore && (indexed || sharded)) {
+        errx(EXIT_FAILURE, "-x and -H need the file store");
+    }
+
+    // names of the file store are file names, and all names have to fit
+    // in the request header
+    if (maxname > (logstore ? REQSIZE : NAME_MAX)) {
+        errx(EXIT_FAILURE, "object names can be at most %d bytes", logstore ? REQSIZE : NAME_MAX);
+    }
+    set_object_limit(maxname);
+
+    // a binary log is not for the terminal
+    if (binarylog && logfile == stderr) {
+        errx(EXIT_FAILURE, "-f binary needs -l");
+    }
+
     uint16_t port = strtouint16(argv[optind]);
     if (port == 0) {
         errx(EXIT_FAILURE, "bad port number: %s", argv[1]);
@@ -351,15 +776,89 @@ int main(int argc, char *argv[]) {
     connection_map = redblack_create();
     maplock = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
 
+    if (syncmode != SYNC_NONE) {
+        syncer = syncer_create(syncmode, DEFAULT_SYNC_WINDOW, resume_synced);
+        if (syncer == NULL) {
+            errx(EXIT_FAILURE, "failed to create syncer");
+        }
+    }
+
+    if (indexed) {
+        index = metaindex_create(DEFAULT_INDEX_BUCKETS);
+        if (index == NULL || metaindex_scan(index, threads, sharded) < 0) {
+            errx(EXIT_FAILURE, "failed to index objects");
+        }
+    }
+
+    probe_tmpfiles();
+    store = logstore ? logstore_create(DEFAULT_SEGMENT_SIZE) : filestore_create(index, sharded);
+    if (store == NULL) {
+        errx(EXIT_FAILURE, "failed to create store");
+    }
+
+    if (appender_recover(store) < 0) {
+        errx(EXIT_FAILURE, "failed to recover from interrupted APPENDs");
+    }
+
+    request_logger = logger_create(logfile, DEFAULT_LOG_SLOTS, binarylog);
+    if (request_logger == NULL) {
+        errx(EXIT_FAILURE, "failed to create logger");
+    }
+
+    file_locks = locktable_create(DEFAULT_LOCK_STRIPES);
+    if (file_locks == NULL) {
+        errx(EXIT_FAILURE, "failed to create file locks");
+    }
+
+    if (inplace) {
+        appender = appender_create(DEFAULT_APPEND_SLOTS, syncmode != SYNC_NONE);
+        if (appender == NULL) {
+            errx(EXIT_FAILURE, "failed to create appender");
+        }
+    }
+
+    if (mmapsize > 0) {
+        mmap_cache = mmapcache_create(DEFAULT_MMAP_SLOTS, mmapsize);
+        if (mmap_cache == NULL) {
+            errx(EXIT_FAILURE, "failed to create mmap cache");
+        }
+    }
+
+    if (metricsport != 0) {
+        metrics = metrics_create(threads, metricsport);
+        if (metrics == NULL) {
+            errx(EXIT_FAILURE, "failed to serve metrics on port %" PRIu16, metricsport);
+        }
+    }
+
+    // the main thread counts too
+    if (shared) {
+        char name[STATS_NAMELEN];
+
+        stats_name(port, name);
+        stats = stats_create(name, threads + 1);
+        if (stats == NULL) {
+            err(EXIT_FAILURE, "failed to create stats segment %s", name);
+        }
+        stats_attach(stats);
+    }
+
     thread_pool = threadpool_create(threads, handle_connection);
     thread_pool->cmap = connection_map;
-    thread_pool->cmlock = maplock;
+    thread_pool->cmlock = &maplock;
     thread_pool->cpoll = connection_poll;
+    thread_pool->metrics = metrics;
+    if (syncer != NULL) {
+        thread_pool->sync_func = sync_connection;
+    }
+    thread_pool->stats = stats;
 
     add_connection(connection_poll, listenfd, EPOLLIN);
 
     for (;;) {
-        poll_connections(connection_poll);
+        ssize_t nevents = poll_connections(connection_poll);
+        stats_count(STAT_WAKEUPS, 1);
+        stats_count(STAT_EVENTS, nevents > 0 ? nevents : 0);
 
         int connfd;
         connection_t *conn;
@@ -369,9 +868,15 @@ int main(int argc, char *argv[]) {
                 int connfd = accept(listenfd, NULL, NULL);
                 conn = connection_create();
                 conn->connfd = connfd;
+                PROBE1(accept, connfd);
+                if (metrics != NULL) {
+                    metrics_accepted(metrics);
+                }
+                stats_count(STAT_ACCEPTS, 1);
             } else {
-                pthread_mutex_lock(&maplock);
+                stats_lock_mutex(&maplock, STAT_MAPLOCK_WAITS);
                 conn = redblack_extract(connection_map, connfd);
+                PROBE1(resume, connfd);
                 delete_connection(connection_poll, connfd);
                 pthread_mutex_unlock(&maplock);
             }
@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 
 #include "ioutil.h"
+#include "stats.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -161,18 +162,224 @@ int64_t sizeof_file(int fd, status_t *status) {
     return statbuf.st_size;
 }
 
+// wrapper function for syscall fstat() for an opened object
+// that rejects directories. returns 0 on success, or -1 and
+// updates status if the file cannot be served
+//
+// fd     : file's file descriptor
+// statbuf: stat struct filled in for the file
+// status : status pertaining to an http response
+//
+int stat_file(int fd, struct stat *statbuf, status_t *status) {
+    if (fstat(fd, statbuf) < 0) {
+        if (errno == EACCES) {
+            *status = FORBIDDEN;
+        } else {
+            *status = INT_ERR;
+        }
+
+        return -1;
+    }
+
+    if (S_ISDIR(statbuf->st_mode) != 0) {
+        *status = FORBIDDEN;
+        return -1;
+    }
+
+    return 0;
+}
+
+// wrapper function for syscall stat() that looks an object up
+// by name without opening it and rejects directories. returns 0
+// on success, or -1 and updates status on failure
+//
+// filename: name of the file
+// statbuf : stat struct filled in for the file
+// status  : status pertaining to an http response
+//
+int stat_path(char filename[], struct stat *statbuf, status_t *status) {
+    if (stat(filename, statbuf) < 0) {
+        if (errno == ENOENT) {
+            *status = FILE_NOT_FOUND;
+        } else if (errno == EACCES) {
+            *status = FORBIDDEN;
+        } else {
+            *status = BAD_REQUEST;
+        }
+
+        return -1;
+    }
+
+    if (S_ISDIR(statbuf->st_mode) != 0) {
+        *status = FORBIDDEN;
+        return -1;
+    }
+
+    return 0;
+}
+
+// whether the O_TMPFILE inodes of this directory can be committed, see
+// probe_tmpfiles()
+static bool anonymous_tmpfiles = false;
+
+// checks once at startup whether anonymous tmpfiles can be used. they are
+// committed by linking their /proc/self/fd entry, which needs both
+// O_TMPFILE support and a mounted /proc, and otherwise every commit would
+// fail. without them create_tmpfile() makes named files
+//
+void probe_tmpfiles(void) {
+    char procpath[32], probename[32];
+    int tmpfd = open(".", O_TMPFILE | O_RDWR, 0600);
+
+    if (tmpfd < 0) {
+        return;
+    }
+
+    snprintf(procpath, sizeof procpath, "/proc/self/fd/%d", tmpfd);
+    snprintf(probename, sizeof probename, "probe-%d", (int) getpid());
+    if (linkat(AT_FDCWD, procpath, AT_FDCWD, probename, AT_SYMLINK_FOLLOW) == 0) {
+        unlink(probename);
+        anonymous_tmpfiles = true;
+    }
+
+    close(tmpfd);
+}
+
+// creates the temporary file a request body is written to before it
+// is committed. the file is an anonymous O_TMPFILE inode in the working
+// directory when probe_tmpfiles() found them usable, so it never has a
+// name and vanishes on a crash. otherwise a named file is made with
+// mkstemp() and its name is copied into tmpname, which is left empty for
+// an anonymous file. returns the file descriptor or -1 on failure
+//
+// tmpname: buffer for the name of the file, at least TMPSIZE bytes
+// status : status pertaining to an http response
+//
 int create_tmpfile(char *tmpname, status_t *status) {
     char filename[] = "tmpfileXXXXXX";
     size_t len = strlen(filename);
+    int tmpfd;
 
-    int tmpfd = mkstemp(filename);
+    if (anonymous_tmpfiles) {
+        tmpfd = open(".", O_TMPFILE | O_RDWR, 0600);
+        if (tmpfd >= 0) {
+            stats_count(STAT_TMPFILES, 1);
+            tmpname[0] = '\0';
+            return tmpfd;
+        }
+    }
+
+    tmpfd = mkstemp(filename);
     if (tmpfd < 0) {
         *status = INT_ERR;
         return -1;
     }
 
+    stats_count(STAT_TMPFILES, 1);
     memcpy(tmpname, filename, len);
     tmpname[len] = '\0';
 
     return tmpfd;
 }
+
+// commits a finished temporary file as the new version of filename in a
+// single atomic step, so there is never a moment where the object does not
+// exist. an anonymous file is linked straight in if the object is new, and
+// otherwise linked under a private name next to the object that is renamed
+// over it. the private name contains a '-', which object names cannot, and
+// the descriptor number makes it unique within the process. a stale
+// private name left behind by a crash between the link and the rename is
+// reclaimed. status is set to CREATED or OK depending on whether the
+// object existed. returns 0 on success, or -1 and sets status to INT_ERR
+// on failure
+//
+// tmpfd   : temporary file's file descriptor
+// tmpname : name of the temporary file, empty for an anonymous file
+// filename: name of the object
+// status  : status pertaining to an http response
+//
+int commit_tmpfile(int tmpfd, char *tmpname, char filename[], status_t *status) {
+    char procpath[32], linkname[PATH_MAX], *slash;
+    int dirlen;
+
+    if (tmpname[0] == '\0') {
+        snprintf(procpath, sizeof procpath, "/proc/self/fd/%d", tmpfd);
+        if (linkat(AT_FDCWD, procpath, AT_FDCWD, filename, AT_SYMLINK_FOLLOW) == 0) {
+            *status = CREATED;
+            return 0;
+        }
+
+        if (errno != EEXIST) {
+            *status = INT_ERR;
+            return -1;
+        }
+
+        // the private name goes in the object's own directory, which is
+        // a shard directory for sharded objects. only this process makes
+        // such names, one left over from a crash is removed first
+        slash = strrchr(filename, '/');
+        dirlen = slash != NULL ? slash - filename + 1 : 0;
+        snprintf(linkname, sizeof linkname, "%.*scommit-%d", dirlen, filename, tmpfd);
+        unlink(linkname);
+        if (linkat(AT_FDCWD, procpath, AT_FDCWD, linkname, AT_SYMLINK_FOLLOW) < 0) {
+            *status = INT_ERR;
+            return -1;
+        }
+
+        tmpname = linkname;
+    } else if (renameat2(AT_FDCWD, tmpname, AT_FDCWD, filename, RENAME_NOREPLACE) == 0) {
+        *status = CREATED;
+        return 0;
+    }
+
+    if (rename(tmpname, filename) < 0) {
+        unlink(tmpname);
+        *status = INT_ERR;
+        return -1;
+    }
+
+    *status = OK;
+    return 0;
+}
+
+// preallocates the blocks for nbytes of a file from offset on that are
+// about to be written so they are laid out in as few extents as possible
+// and a full disk is detected before any of it is written. the file size
+// is kept as is, so it still only grows as bytes are written. returns 0 on
+// success (or if the filesystem cannot preallocate), or -1 and updates
+// status on failure
+//
+// fd    : file's file descriptor
+// offset: offset of the first byte to reserve
+// nbytes: number of bytes to reserve
+// status: status pertaining to an http response
+//
+int reserve_file(int fd, off_t offset, int64_t nbytes, status_t *status) {
+    if (nbytes <= 0 || fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, nbytes) == 0) {
+        return 0;
+    }
+
+    switch (errno) {
+    case EOPNOTSUPP:
+    case ENOSYS: return 0;
+    case ENOSPC:
+    case EDQUOT:
+    case EFBIG: *status = NO_SPACE; return -1;
+    default: *status = INT_ERR; return -1;
+    }
+}
+
+// puts a file descriptor in non-blocking mode for syscalls such as
+// sendfile() that have no per-call non-blocking flag. returns 0 on
+// success and -1 on failure
+//
+// fd: file descriptor
+//
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) {
+        return -1;
+    }
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
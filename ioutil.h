@@ -3,6 +3,7 @@
 
 #include "status.h"
 #include "util.h"
+#include <sys/stat.h>
 #include <sys/types.h>
 
 // * borrowed and modified from my own work at:
@@ -23,6 +24,18 @@ int file_is_dir(int fd, status_t *status);
 
 int64_t sizeof_file(int fd, status_t *status);
 
+int stat_file(int fd, struct stat *statbuf, status_t *status);
+
+int stat_path(char filename[], struct stat *statbuf, status_t *status);
+
+void probe_tmpfiles(void);
+
 int create_tmpfile(char *tmpname, status_t *status);
 
+int commit_tmpfile(int tmpfd, char *tmpname, char filename[], status_t *status);
+
+int reserve_file(int fd, off_t offset, int64_t nbytes, status_t *status);
+
+int set_nonblocking(int fd);
+
 #endif
@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+
+#include "locktable.h"
+#include "probe.h"
+#include "stats.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+// a fixed table of reader-writer locks striped by object name hash. all
+// requests for one object always map to the same lock, while requests for
+// unrelated objects are spread across the table and rarely contend
+
+struct locktable_t {
+    pthread_rwlock_t *locks;
+    size_t nstripes;
+};
+
+static pthread_rwlock_t *locktable_stripe(locktable_t *lt, char *name) {
+    return &lt->locks[strhash(name) % lt->nstripes];
+}
+
+// creates a lock table with nstripes locks. the locks prefer writers so
+// that a steady stream of readers cannot starve PUT and APPEND commits
+//
+// nstripes: number of locks in the table
+//
+locktable_t *locktable_create(size_t nstripes) {
+    pthread_rwlockattr_t attr;
+
+    locktable_t *lt = (locktable_t *) malloc(sizeof(locktable_t));
+    if (lt == NULL) {
+        return NULL;
+    }
+
+    lt->locks = (pthread_rwlock_t *) calloc(nstripes, sizeof(pthread_rwlock_t));
+    if (lt->locks == NULL) {
+        free(lt);
+        return NULL;
+    }
+
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    for (size_t i = 0; i < nstripes; i++) {
+        pthread_rwlock_init(&lt->locks[i], &attr);
+    }
+    pthread_rwlockattr_destroy(&attr);
+
+    lt->nstripes = nstripes;
+    return lt;
+}
+
+void locktable_destroy(locktable_t **lt) {
+    if (lt && *lt) {
+        for (size_t i = 0; i < (*lt)->nstripes; i++) {
+            pthread_rwlock_destroy(&(*lt)->locks[i]);
+        }
+
+        free((*lt)->locks);
+        free(*lt);
+        *lt = NULL;
+    }
+}
+
+// locks an object in shared mode, for requests that only read it
+//
+// lt  : lock table
+// name: object name
+//
+void locktable_rdlock(locktable_t *lt, char *name) {
+    PROBE2(lock__wait, name, 0);
+    stats_lock_rwlock(locktable_stripe(lt, name), false, STAT_LOCK_WAITS);
+    PROBE2(lock__acquire, name, 0);
+}
+
+// locks an object in exclusive mode, for requests that modify it
+//
+// lt  : lock table
+// name: object name
+//
+void locktable_wrlock(locktable_t *lt, char *name) {
+    PROBE2(lock__wait, name, 1);
+    stats_lock_rwlock(locktable_stripe(lt, name), true, STAT_LOCK_WAITS);
+    PROBE2(lock__acquire, name, 1);
+}
+
+// unlocks an object locked in either mode
+//
+// lt  : lock table
+// name: object name
+//
+void locktable_unlock(locktable_t *lt, char *name) {
+    pthread_rwlock_unlock(locktable_stripe(lt, name));
+    PROBE1(lock__release, name);
+}
@@ -0,0 +1,18 @@
+#ifndef __LOCKTABLE_H__
+#define __LOCKTABLE_H__
+
+#include <sys/types.h>
+
+typedef struct locktable_t locktable_t;
+
+locktable_t *locktable_create(size_t nstripes);
+
+void locktable_destroy(locktable_t **lt);
+
+void locktable_rdlock(locktable_t *lt, char *name);
+
+void locktable_wrlock(locktable_t *lt, char *name);
+
+void locktable_unlock(locktable_t *lt, char *name);
+
+#endif
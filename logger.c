@@ -0,0 +1,339 @@
+#include "logger.h"
+#include "binlog.h"
+#include "util.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the request log. workers never write the logfile themselves: they put a
+// fixed-size record of each completed request into a bounded ring and a
+// writer thread formats the records in order and writes them out in
+// batches, so logging costs a request a copy instead of a write syscall.
+//
+// the ring is a multi-producer single-consumer queue of sequenced slots.
+// a producer takes a ticket with one atomic add, which is where the
+// record is ordered against all others: log_request is called with the
+// object's lock held, so the tickets of the requests to one object follow
+// the order in which they took the lock. slot ticket % nslots holds the
+// record once its sequence number reads ticket + 1, and is free for
+// ticket + nslots once the writer sets it to that. the writer consumes
+// tickets strictly in order, so the log is written in ticket order even
+// though records are filled in concurrently. producers wait for a slot to
+// be freed when the writer falls a whole ring behind.
+//
+// in binary mode the writer writes binlog.h records instead of text. it
+// gives every object name an id the first time it writes it and only
+// writes the id after that, until it has seen MAX_NAMES names and starts
+// over
+
+#define IDLE_WAIT_NS 10000000
+#define MAX_NAMES    4096
+#define NAME_SLOTS   (2 * MAX_NAMES)
+
+typedef struct {
+    _Atomic uint64_t seq;
+    method_t method;
+    status_t status;
+    uint32_t reqid;
+    uint32_t latency;
+    uint64_t time;
+    bool named;
+    char name[REQSIZE];
+} logrec_t;
+
+typedef struct {
+    char *name;
+    uint32_t id;
+} nameslot_t;
+
+struct logger_t {
+    FILE *file;
+    bool binary;
+    nameslot_t *names;
+    uint32_t nnames;
+    logrec_t *slots;
+    size_t nslots;
+    _Atomic uint64_t tail;
+    uint64_t head;
+    _Atomic bool idle;
+    bool stopping;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+static void write_text(FILE *file, logrec_t *rec) {
+    // requests rejected before their object was parsed are logged as they
+    // always were, with the null name
+    char *name = rec->named ? rec->name : NULL;
+
+    switch (rec->method) {
+    case GET: fprintf(file, GET_LOG_MSG, name, rec->status, rec->reqid); break;
+    case PUT: fprintf(file, PUT_LOG_MSG, name, rec->status, rec->reqid); break;
+    case APPEND: fprintf(file, APPEND_LOG_MSG, name, rec->status, rec->reqid); break;
+    case HEAD: fprintf(file, HEAD_LOG_MSG, name, rec->status, rec->reqid); break;
+    default: break;
+    }
+}
+
+// forgets every name the writer has given an id
+//
+static void clear_names(logger_t *lg) {
+    for (size_t i = 0; i < NAME_SLOTS; i++) {
+        free(lg->names[i].name);
+        lg->names[i].name = NULL;
+    }
+
+    lg->nnames = 0;
+}
+
+// returns the id of an object name, writing a name record for it first if
+// it does not have one
+//
+static uint32_t name_id(logger_t *lg, char *name) {
+    binlog_head_t head = { .kind = BINLOG_NAME };
+    size_t i = strhash(name) % NAME_SLOTS;
+
+    for (; lg->names[i].name != NULL; i = (i + 1) % NAME_SLOTS) {
+        if (strcmp(lg->names[i].name, name) == 0) {
+            return lg->names[i].id;
+        }
+    }
+
+    if (lg->nnames == MAX_NAMES) {
+        clear_names(lg);
+        i = strhash(name) % NAME_SLOTS;
+    }
+
+    // a name the writer cannot remember is written again the next time
+    head.nameid = lg->nnames;
+    head.value = strlen(name);
+    lg->names[i].name = strdup(name);
+    if (lg->names[i].name != NULL) {
+        lg->names[i].id = lg->nnames++;
+    }
+
+    fwrite(&head, sizeof(head), 1, lg->file);
+    fwrite(name, 1, head.value, lg->file);
+    return head.nameid;
+}
+
+static void write_binary(logger_t *lg, logrec_t *rec) {
+    binlog_req_t out = {
+        .head = { .kind = BINLOG_REQUEST, .method = rec->method, .value = rec->status },
+        .reqid = rec->reqid,
+        .latency = rec->latency,
+        .time = rec->time,
+    };
+
+    if (rec->method == NONE) {
+        return;
+    }
+
+    out.head.nameid = rec->named ? name_id(lg, rec->name) : BINLOG_NONAME;
+    fwrite(&out, sizeof(out), 1, lg->file);
+}
+
+static void write_record(logger_t *lg, logrec_t *rec) {
+    if (lg->binary) {
+        write_binary(lg, rec);
+    } else {
+        write_text(lg->file, rec);
+    }
+}
+
+// writes out every record published so far, in ticket order. returns the
+// number of records written
+//
+static size_t drain_records(logger_t *lg) {
+    size_t n = 0;
+
+    for (;;) {
+        logrec_t *rec = &lg->slots[lg->head % lg->nslots];
+        if (atomic_load_explicit(&rec->seq, memory_order_acquire) != lg->head + 1) {
+            return n;
+        }
+
+        write_record(lg, rec);
+        atomic_store_explicit(&rec->seq, lg->head + lg->nslots, memory_order_release);
+        lg->head++;
+        n++;
+    }
+}
+
+// writer thread. drains the ring and flushes the batch whenever it runs
+// dry, then sleeps until a producer wakes it
+//
+// arg: logger
+//
+static void *write_records(void *arg) {
+    logger_t *lg = (logger_t *) arg;
+    struct timespec deadline;
+    bool stopping = false;
+
+    while (stopping == false) {
+        if (drain_records(lg) > 0) {
+            continue;
+        }
+
+        fflush(lg->file);
+
+        // the timeout covers a producer that checked idle just before it
+        // was set
+        pthread_mutex_lock(&lg->lock);
+        atomic_store(&lg->idle, true);
+        if (lg->stopping == false
+            && atomic_load(&lg->slots[lg->head % lg->nslots].seq) != lg->head + 1) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += IDLE_WAIT_NS;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&lg->wake, &lg->lock, &deadline);
+        }
+        atomic_store(&lg->idle, false);
+        stopping = lg->stopping;
+        pthread_mutex_unlock(&lg->lock);
+    }
+
+    // every producer is gone, whatever they published is written out
+    drain_records(lg);
+    fflush(lg->file);
+    return NULL;
+}
+
+// creates a logger writing to a file and starts its writer thread. a
+// binary logger starts the file with the binlog.h magic
+//
+// file  : logfile
+// nslots: number of records the ring holds
+// binary: whether to write binary records instead of text lines
+//
+logger_t *logger_create(FILE *file, size_t nslots, bool binary) {
+    logger_t *lg = (logger_t *) malloc(sizeof(logger_t));
+    if (lg == NULL) {
+        return NULL;
+    }
+
+    lg->slots = (logrec_t *) malloc(nslots * sizeof(logrec_t));
+    if (lg->slots == NULL) {
+        free(lg);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < nslots; i++) {
+        atomic_init(&lg->slots[i].seq, i);
+    }
+
+    lg->names = NULL;
+    if (binary) {
+        lg->names = (nameslot_t *) calloc(NAME_SLOTS, sizeof(nameslot_t));
+        if (lg->names == NULL) {
+            free(lg->slots);
+            free(lg);
+            return NULL;
+        }
+        fwrite(BINLOG_MAGIC, 1, BINLOG_MAGIC_LEN, file);
+    }
+
+    lg->file = file;
+    lg->binary = binary;
+    lg->nnames = 0;
+    lg->nslots = nslots;
+    atomic_init(&lg->tail, 0);
+    lg->head = 0;
+    atomic_init(&lg->idle, false);
+    lg->stopping = false;
+    lg->lock = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    lg->wake = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+
+    if (pthread_create(&lg->writer, NULL, write_records, lg) != 0) {
+        free(lg->names);
+        free(lg->slots);
+        free(lg);
+        return NULL;
+    }
+
+    return lg;
+}
+
+// writes out the records still in the ring, stops the writer and frees the
+// logger. the workers must have been stopped before this. the file is
+// flushed but not closed
+//
+void logger_destroy(logger_t **lg) {
+    if (lg && *lg) {
+        pthread_mutex_lock(&(*lg)->lock);
+        (*lg)->stopping = true;
+        pthread_cond_signal(&(*lg)->wake);
+        pthread_mutex_unlock(&(*lg)->lock);
+
+        pthread_join((*lg)->writer, NULL);
+        pthread_mutex_destroy(&(*lg)->lock);
+        pthread_cond_destroy(&(*lg)->wake);
+        if ((*lg)->names != NULL) {
+            clear_names(*lg);
+            free((*lg)->names);
+        }
+        free((*lg)->slots);
+        free(*lg);
+        *lg = NULL;
+    }
+}
+
+// logs a completed request. callers hold the request's object lock, so
+// the ticket taken here orders the record after every earlier request to
+// the same object
+//
+// lg    : logger
+// req   : pointer to request struct
+// status: status code the request completed with
+//
+void logger_log(logger_t *lg, request_t *req, status_t status) {
+    uint64_t ticket, latency;
+    logrec_t *rec;
+    struct timespec now, end;
+    size_t len;
+
+    // the clocks are read before the ticket is taken, so a full ring does
+    // not count towards the latency
+    if (lg->binary) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+
+    ticket = atomic_fetch_add(&lg->tail, 1);
+    rec = &lg->slots[ticket % lg->nslots];
+
+    // the ring is full, the writer frees this slot once it catches up
+    while (atomic_load_explicit(&rec->seq, memory_order_acquire) != ticket) {
+        sched_yield();
+    }
+
+    rec->method = req->reqline.method;
+    rec->status = status;
+    rec->reqid = req->fields.reqid;
+    if (lg->binary) {
+        latency = (end.tv_sec - req->start.tv_sec) * 1000000
+                  + (end.tv_nsec - req->start.tv_nsec) / 1000;
+        rec->latency = latency > UINT32_MAX ? UINT32_MAX : latency;
+        rec->time = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+    }
+    rec->named = req->reqline.object != NULL;
+    if (rec->named) {
+        len = strnlen(req->reqline.object, REQSIZE - 1);
+        memcpy(rec->name, req->reqline.object, len);
+        rec->name[len] = '\0';
+    }
+    atomic_store_explicit(&rec->seq, ticket + 1, memory_order_release);
+
+    if (atomic_load(&lg->idle)) {
+        pthread_mutex_lock(&lg->lock);
+        pthread_cond_signal(&lg->wake);
+        pthread_mutex_unlock(&lg->lock);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include "request.h"
+#include "status.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct logger_t logger_t;
+
+logger_t *logger_create(FILE *file, size_t nslots, bool binary);
+
+void logger_destroy(logger_t **lg);
+
+void logger_log(logger_t *lg, request_t *req, status_t status);
+
+#endif
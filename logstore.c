@@ -0,0 +1,942 @@
+#define _GNU_SOURCE
+
+#include "logstore.h"
+#include "ioutil.h"
+#include "util.h"
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// the log-structured storage backend: objects are records appended to
+// large segment files in the working directory and found through an index
+// in memory, so an object costs no inode or directory entry of its own. a
+// PUT of known length streams its body straight into a record it reserves
+// at the tail of the active segment. bodies of unknown length and APPENDs
+// are staged in a tmpfile and copied into a new record when they commit
+// (an APPEND rewrites the whole object, which is cheap for small objects)
+//
+// a record is a header, the object name and room for the object bytes. the
+// header is written when the record is reserved and rewritten with the
+// final size and the committed flag once the index points at the record,
+// so records a crash left half written are skipped when the index is
+// rebuilt from the segments at startup. replaced versions and abandoned
+// records are dead space, which a compactor thread reclaims by moving the
+// live records of mostly dead segments to the tail and deleting them
+
+#define LOG_MAGIC        0x676f6c73
+#define RECORD_COMMITTED 1
+#define INITIAL_BUCKETS  1024
+#define MAX_NAME_LEN     4096
+#define SEGMENT_NAMESIZE 16
+#define COMPACT_INTERVAL 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t namelen;
+    uint32_t pad;
+    uint64_t seq;
+    uint64_t reserved;
+    uint64_t size;
+    int64_t sec, nsec;
+} record_t;
+
+typedef struct logentry_t logentry_t;
+
+struct logentry_t {
+    logentry_t *next;
+    char *name;
+    uint32_t seg;
+    off_t rec;
+    off_t len;
+    size_t size;
+    uint64_t seq;
+    struct timespec mtime;
+};
+
+typedef struct {
+    int fd;
+    off_t tail;
+    off_t live;
+} segment_t;
+
+typedef struct {
+    int fd;
+    off_t off;
+    size_t len;
+} part_t;
+
+typedef struct {
+    store_t store;
+    logentry_t **buckets;
+    size_t nbuckets, nentries;
+    segment_t *segs;
+    uint32_t nsegs, capsegs;
+    off_t segsize;
+    uint64_t seq;
+    int dirfd;
+    bool stopping;
+    bool compacting;
+    pthread_t compactor;
+    pthread_cond_t wake;
+    pthread_mutex_t lock;
+} logstore_t;
+
+static void segment_name(uint32_t id, char *name) {
+    snprintf(name, SEGMENT_NAMESIZE, "%08" PRIx32 ".seg", id);
+}
+
+// returns true and sets id if name is the name of a segment
+//
+static bool is_segment_name(char *name, uint32_t *id) {
+    char *end;
+
+    if (strlen(name) != 12 || strcmp(name + 8, ".seg") != 0) {
+        return false;
+    }
+
+    *id = strtoul(name, &end, 16);
+    return end == name + 8;
+}
+
+static off_t record_len(uint32_t namelen, uint64_t reserved) {
+    return sizeof(record_t) + namelen + reserved;
+}
+
+// offset of the object bytes of a record
+//
+static off_t record_data(off_t rec, uint32_t namelen) {
+    return rec + sizeof(record_t) + namelen;
+}
+
+static logentry_t *index_find(logstore_t *ls, char *name) {
+    logentry_t *e = ls->buckets[strhash(name) % ls->nbuckets];
+
+    while (e != NULL && strcmp(e->name, name) != 0) {
+        e = e->next;
+    }
+
+    return e;
+}
+
+// doubles the number of buckets of the index, keeping the longer chains if
+// there is no memory for more
+//
+static void index_grow(logstore_t *ls) {
+    size_t nbuckets = ls->nbuckets * 2;
+    logentry_t **buckets = (logentry_t **) calloc(nbuckets, sizeof(logentry_t *));
+    if (buckets == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < ls->nbuckets; i++) {
+        logentry_t *e = ls->buckets[i];
+
+        while (e != NULL) {
+            logentry_t *next = e->next;
+            size_t b = strhash(e->name) % nbuckets;
+
+            e->next = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+
+    free(ls->buckets);
+    ls->buckets = buckets;
+    ls->nbuckets = nbuckets;
+}
+
+// adds an entry for a new object, which points at no record yet. returns
+// NULL if there is no memory for it
+//
+static logentry_t *index_add(logstore_t *ls, char *name) {
+    logentry_t *e = (logentry_t *) calloc(1, sizeof(logentry_t));
+    if (e == NULL || (e->name = strdup(name)) == NULL) {
+        free(e);
+        return NULL;
+    }
+
+    if (++ls->nentries > ls->nbuckets) {
+        index_grow(ls);
+    }
+
+    size_t b = strhash(name) % ls->nbuckets;
+    e->next = ls->buckets[b];
+    ls->buckets[b] = e;
+    return e;
+}
+
+// points an entry at a record, moving the bytes of the record it pointed
+// at before out of the live bytes of that record's segment
+//
+static void index_point(logstore_t *ls, logentry_t *e, uint32_t seg, off_t rec, off_t len) {
+    if (e->len > 0) {
+        ls->segs[e->seg].live -= e->len;
+    }
+
+    e->seg = seg;
+    e->rec = rec;
+    e->len = len;
+    ls->segs[seg].live += len;
+}
+
+// makes room for more segments. returns 0 on success, -1 on failure
+//
+static int grow_segments(logstore_t *ls, uint32_t capsegs) {
+    segment_t *segs = (segment_t *) realloc(ls->segs, capsegs * sizeof(segment_t));
+    if (segs == NULL) {
+        return -1;
+    }
+
+    ls->segs = segs;
+    ls->capsegs = capsegs;
+    return 0;
+}
+
+// starts a new active segment after the last one. returns 0 on success,
+// -1 on failure
+//
+static int add_segment(logstore_t *ls) {
+    char name[SEGMENT_NAMESIZE];
+    int fd;
+
+    if (ls->nsegs == ls->capsegs && grow_segments(ls, ls->capsegs * 2 + 16) < 0) {
+        return -1;
+    }
+
+    segment_name(ls->nsegs, name);
+    fd = openat(ls->dirfd, name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // the segment has to survive a crash for the records put in it to
+    fsync(ls->dirfd);
+    ls->segs[ls->nsegs++] = (segment_t) { .fd = fd, .tail = 0, .live = 0 };
+    return 0;
+}
+
+// reserves a record for nbytes of an object at the tail of the active
+// segment, starting a new segment if it is full, and writes its header
+// without the committed flag. the header is written before the record is
+// given out so that records always follow each other in a segment. returns
+// a descriptor of the segment with its own file offset, or -1 and updates
+// the status code on failure
+//
+// ls    : log store
+// name  : object name
+// nbytes: bytes reserved for the object
+// seg   : set to the segment of the record
+// rec   : set to the offset of the record in the segment
+// status: status code tracking request status
+//
+static int reserve_record(
+    logstore_t *ls, char *name, uint64_t nbytes, uint32_t *seg, off_t *rec, status_t *status) {
+    char segname[SEGMENT_NAMESIZE];
+    uint32_t namelen = strlen(name);
+    off_t len = record_len(namelen, nbytes);
+    record_t hdr = { .magic = LOG_MAGIC, .namelen = namelen, .reserved = nbytes };
+    struct iovec iov[2] = { { &hdr, sizeof hdr }, { name, namelen } };
+    int fd = -1;
+
+    pthread_mutex_lock(&ls->lock);
+    if (ls->segs[ls->nsegs - 1].tail > 0 && ls->segs[ls->nsegs - 1].tail + len > ls->segsize
+        && add_segment(ls) < 0) {
+        pthread_mutex_unlock(&ls->lock);
+        *status = INT_ERR;
+        return -1;
+    }
+
+    *seg = ls->nsegs - 1;
+    *rec = ls->segs[*seg].tail;
+    if (pwritev(ls->segs[*seg].fd, iov, 2, *rec) == (ssize_t) (sizeof hdr + namelen)) {
+        ls->segs[*seg].tail += len;
+        segment_name(*seg, segname);
+        fd = openat(ls->dirfd, segname, O_RDWR | O_CLOEXEC);
+    }
+    pthread_mutex_unlock(&ls->lock);
+
+    if (fd < 0) {
+        *status = INT_ERR;
+        return -1;
+    }
+
+    if (reserve_file(fd, *rec, len, status) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// makes a record whose object bytes are in place the newest version of
+// the object and marks it committed. returns 0 on success, 1 if its
+// segment was compacted away in the meantime and the record has to be
+// written again elsewhere, or -1 on failure
+//
+// ls      : log store
+// name    : object name
+// fd      : descriptor of the record's segment
+// seg     : segment of the record
+// rec     : offset of the record in the segment
+// reserved: bytes reserved for the object in the record
+// size    : size of the object
+// created : set if there was no earlier version of the object
+//
+static int commit_record(logstore_t *ls, char *name, int fd, uint32_t seg, off_t rec,
+    uint64_t reserved, size_t size, bool *created) {
+    uint32_t namelen = strlen(name);
+    record_t hdr = { .magic = LOG_MAGIC,
+        .flags = RECORD_COMMITTED,
+        .namelen = namelen,
+        .reserved = reserved,
+        .size = size };
+    struct timespec now;
+    logentry_t *e;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    hdr.sec = now.tv_sec;
+    hdr.nsec = now.tv_nsec;
+
+    pthread_mutex_lock(&ls->lock);
+    if (ls->segs[seg].fd < 0) {
+        pthread_mutex_unlock(&ls->lock);
+        return 1;
+    }
+
+    e = index_find(ls, name);
+    *created = e == NULL;
+    if (e == NULL && (e = index_add(ls, name)) == NULL) {
+        pthread_mutex_unlock(&ls->lock);
+        return -1;
+    }
+
+    index_point(ls, e, seg, rec, record_len(namelen, reserved));
+    e->size = size;
+    e->seq = hdr.seq = ++ls->seq;
+    e->mtime = now;
+    pthread_mutex_unlock(&ls->lock);
+
+    // readers are served from the index already, the flag is for recovery
+    return pwrite(fd, &hdr, sizeof hdr, rec) == sizeof hdr ? 0 : -1;
+}
+
+// copies len bytes between two descriptors at the given offsets. returns
+// 0 on success, -1 on failure
+//
+static int copy_range(int infd, off_t inoff, int outfd, off_t outoff, size_t len) {
+    ssize_t cbytes;
+
+    while (len > 0) {
+        cbytes = copy_file_range(infd, &inoff, outfd, &outoff, len, 0);
+        if (cbytes <= 0) {
+            return -1;
+        }
+
+        len -= cbytes;
+    }
+
+    return 0;
+}
+
+// writes an object into a new record, copying its bytes out of the given
+// parts in order, and commits it. leaves a descriptor of the record's
+// segment in req->object.fd. returns 0 on success, -1 and updates the
+// status code on failure
+//
+// ls     : log store
+// req    : pointer to request struct
+// parts  : where the bytes of the object are
+// nparts : number of parts
+// created: set if there was no earlier version of the object
+//
+static int write_record(logstore_t *ls, request_t *req, part_t *parts, int nparts, bool *created) {
+    uint32_t namelen = strlen(req->reqline.object);
+    size_t size = 0;
+    uint32_t seg;
+    off_t rec, dst;
+    int fd, rc;
+
+    for (int i = 0; i < nparts; i++) {
+        size += parts[i].len;
+    }
+
+    do {
+        fd = reserve_record(ls, req->reqline.object, size, &seg, &rec, &req->status);
+        if (fd < 0) {
+            return -1;
+        }
+
+        dst = record_data(rec, namelen);
+        for (int i = 0; i < nparts; i++) {
+            if (copy_range(parts[i].fd, parts[i].off, fd, dst, parts[i].len) < 0) {
+                close(fd);
+                req->status = INT_ERR;
+                return -1;
+            }
+
+            dst += parts[i].len;
+        }
+
+        rc = commit_record(ls, req->reqline.object, fd, seg, rec, size, size, created);
+        if (rc != 0) {
+            close(fd);
+        }
+    } while (rc > 0);
+
+    if (rc < 0) {
+        req->status = INT_ERR;
+        return -1;
+    }
+
+    req->object.fd = fd;
+    return 0;
+}
+
+static void fill_stat(logentry_t *e, struct stat *statbuf) {
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_mode = S_IFREG | 0644;
+    statbuf->st_size = e->size;
+    statbuf->st_ino = e->seq;
+    statbuf->st_mtim = e->mtime;
+}
+
+static int logstore_open(
+    store_t *store, char *name, struct stat *statbuf, off_t *base, status_t *status) {
+    logstore_t *ls = (logstore_t *) store;
+    logentry_t *e;
+    int fd = -1;
+
+    pthread_mutex_lock(&ls->lock);
+    e = index_find(ls, name);
+    if (e != NULL) {
+        fd = dup(ls->segs[e->seg].fd);
+        fill_stat(e, statbuf);
+        *base = record_data(e->rec, strlen(name));
+    }
+    pthread_mutex_unlock(&ls->lock);
+
+    if (e == NULL) {
+        *status = FILE_NOT_FOUND;
+    } else if (fd < 0) {
+        *status = INT_ERR;
+    }
+
+    return fd;
+}
+
+static int logstore_stat(store_t *store, char *name, struct stat *statbuf, status_t *status) {
+    logstore_t *ls = (logstore_t *) store;
+    logentry_t *e;
+
+    pthread_mutex_lock(&ls->lock);
+    e = index_find(ls, name);
+    if (e != NULL) {
+        fill_stat(e, statbuf);
+    }
+    pthread_mutex_unlock(&ls->lock);
+
+    if (e == NULL) {
+        *status = FILE_NOT_FOUND;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int logstore_check(store_t *store, request_t *req) {
+    logstore_t *ls = (logstore_t *) store;
+    bool found;
+
+    pthread_mutex_lock(&ls->lock);
+    found = index_find(ls, req->reqline.object) != NULL;
+    pthread_mutex_unlock(&ls->lock);
+
+    if (found == false) {
+        if (req->reqline.method == PUT) {
+            req->object.status = CREATED;
+            return 0;
+        }
+
+        req->status = FILE_NOT_FOUND;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int logstore_stage(store_t *store, request_t *req) {
+    logstore_t *ls = (logstore_t *) store;
+    uint32_t seg;
+    off_t rec;
+
+    // a PUT of known length is received straight into its record
+    if (req->reqline.method == PUT && req->fields.chunked == false) {
+        req->tmp.fd = reserve_record(
+            ls, req->reqline.object, req->fields.contlen, &seg, &rec, &req->status);
+        if (req->tmp.fd < 0) {
+            return -1;
+        }
+
+        req->tmp.segment = seg;
+        req->tmp.record = rec;
+        lseek(req->tmp.fd, record_data(rec, strlen(req->reqline.object)), SEEK_SET);
+        return 0;
+    }
+
+    req->tmp.fd = create_tmpfile(req->tmp.name, &req->status);
+    if (req->tmp.fd < 0) {
+        return -1;
+    }
+
+    if (req->tmp.name[0] != '\0') {
+        unlink(req->tmp.name);
+        req->tmp.name[0] = '\0';
+    }
+
+    return reserve_file(req->tmp.fd, 0, req->fields.contlen, &req->status);
+}
+
+static int logstore_commit(store_t *store, request_t *req) {
+    logstore_t *ls = (logstore_t *) store;
+    uint32_t namelen = strlen(req->reqline.object);
+    part_t parts[2];
+    int nparts = 0, oldfd = -1, rc;
+    bool created = false;
+    logentry_t *e;
+    record_t hdr;
+
+    if (req->tmp.segment >= 0) {
+        off_t data = record_data(req->tmp.record, namelen);
+        off_t end = lseek(req->tmp.fd, 0, SEEK_CUR);
+
+        if (end < data || pread(req->tmp.fd, &hdr, sizeof hdr, req->tmp.record) != sizeof hdr) {
+            req->status = INT_ERR;
+            return -1;
+        }
+
+        rc = commit_record(ls, req->reqline.object, req->tmp.fd, req->tmp.segment,
+            req->tmp.record, hdr.reserved, end - data, &created);
+        if (rc == 0) {
+            req->object.fd = req->tmp.fd;
+            req->tmp.fd = -1;
+            req->object.status = created ? CREATED : OK;
+            return 0;
+        }
+
+        if (rc < 0) {
+            req->status = INT_ERR;
+            return -1;
+        }
+
+        // the segment was compacted away while the body was received, the
+        // body is still readable through the descriptor and is copied out
+        parts[nparts++] = (part_t) { req->tmp.fd, data, end - data };
+    } else {
+        if (req->reqline.method == APPEND) {
+            pthread_mutex_lock(&ls->lock);
+            e = index_find(ls, req->reqline.object);
+            if (e != NULL && (oldfd = dup(ls->segs[e->seg].fd)) >= 0) {
+                parts[nparts++] = (part_t) { oldfd, record_data(e->rec, namelen), e->size };
+            }
+            pthread_mutex_unlock(&ls->lock);
+
+            if (oldfd < 0) {
+                req->status = e == NULL ? FILE_NOT_FOUND : INT_ERR;
+                return -1;
+            }
+        }
+
+        parts[nparts++] = (part_t) { req->tmp.fd, 0, lseek(req->tmp.fd, 0, SEEK_END) };
+    }
+
+    rc = write_record(ls, req, parts, nparts, &created);
+    if (oldfd >= 0) {
+        close(oldfd);
+    }
+
+    if (rc == 0 && req->reqline.method == PUT) {
+        req->object.status = created ? CREATED : OK;
+    }
+
+    return rc;
+}
+
+// objects of the log store are only ever changed by commits
+//
+static int logstore_refresh(store_t *store, char *name) {
+    (void) store;
+    (void) name;
+    return 0;
+}
+
+// records are never written in place, so there is nothing to open
+//
+static int logstore_openw(store_t *store, char *name, status_t *status) {
+    (void) store;
+    (void) name;
+    *status = NOT_IMPL;
+    return -1;
+}
+
+// moves the record at off in segment id to the tail if the index still
+// points at it. the moved record keeps the version of the original
+//
+// ls   : log store
+// name : object name of the record
+// srcfd: descriptor of the segment
+// id   : segment being compacted
+// off  : offset of the record in the segment
+//
+static void move_record(logstore_t *ls, char *name, int srcfd, uint32_t id, off_t off) {
+    uint32_t namelen = strlen(name);
+    status_t status = OK;
+    logentry_t *e, copy;
+    uint32_t seg;
+    off_t rec;
+    int fd;
+
+    pthread_mutex_lock(&ls->lock);
+    e = index_find(ls, name);
+    if (e == NULL || e->seg != id || e->rec != off) {
+        pthread_mutex_unlock(&ls->lock);
+        return;
+    }
+    copy = *e;
+    pthread_mutex_unlock(&ls->lock);
+
+    fd = reserve_record(ls, name, copy.size, &seg, &rec, &status);
+    if (fd < 0) {
+        return;
+    }
+
+    if (copy_range(srcfd, record_data(off, namelen), fd, record_data(rec, namelen), copy.size)
+        == 0) {
+        record_t hdr = { .magic = LOG_MAGIC,
+            .flags = RECORD_COMMITTED,
+            .namelen = namelen,
+            .seq = copy.seq,
+            .reserved = copy.size,
+            .size = copy.size,
+            .sec = copy.mtime.tv_sec,
+            .nsec = copy.mtime.tv_nsec };
+        bool moved = false;
+
+        // a PUT or APPEND may have replaced the object while it was copied
+        pthread_mutex_lock(&ls->lock);
+        e = index_find(ls, name);
+        if (e != NULL && e->seg == id && e->rec == off) {
+            index_point(ls, e, seg, rec, record_len(namelen, copy.size));
+            moved = true;
+        }
+        pthread_mutex_unlock(&ls->lock);
+
+        if (moved && pwrite(fd, &hdr, sizeof hdr, rec) != sizeof hdr) {
+            warn("failed to commit a record moved out of segment %" PRIu32, id);
+        }
+    }
+
+    close(fd);
+}
+
+// flushes the segments after segment id, which the records moved out of
+// it went to
+//
+static void sync_segments(logstore_t *ls, uint32_t id) {
+    int fd;
+
+    for (uint32_t i = id + 1;; i++) {
+        pthread_mutex_lock(&ls->lock);
+        if (i >= ls->nsegs) {
+            pthread_mutex_unlock(&ls->lock);
+            return;
+        }
+        fd = ls->segs[i].fd >= 0 ? dup(ls->segs[i].fd) : -1;
+        pthread_mutex_unlock(&ls->lock);
+
+        if (fd >= 0) {
+            fdatasync(fd);
+            close(fd);
+        }
+    }
+}
+
+// moves the live records of a sealed segment to the tail and deletes it.
+// records committed into the segment while it is compacted are moved by
+// another pass, and the segment is left alone for now if a pass makes no
+// progress
+//
+// ls: log store
+// id: segment to compact
+//
+static void compact_segment(logstore_t *ls, uint32_t id) {
+    char segname[SEGMENT_NAMESIZE], name[MAX_NAME_LEN + 1];
+    off_t off, tail, live;
+    record_t hdr;
+    int fd;
+
+    for (;;) {
+        pthread_mutex_lock(&ls->lock);
+        fd = dup(ls->segs[id].fd);
+        tail = ls->segs[id].tail;
+        live = ls->segs[id].live;
+        pthread_mutex_unlock(&ls->lock);
+
+        if (fd < 0) {
+            return;
+        }
+
+        for (off = 0; off < tail; off += record_len(hdr.namelen, hdr.reserved)) {
+            if (pread(fd, &hdr, sizeof hdr, off) != sizeof hdr || hdr.magic != LOG_MAGIC
+                || hdr.namelen > MAX_NAME_LEN
+                || pread(fd, name, hdr.namelen, off + sizeof hdr) != hdr.namelen) {
+                break;
+            }
+
+            name[hdr.namelen] = '\0';
+            move_record(ls, name, fd, id, off);
+        }
+
+        // the moved records must be durable before the originals are gone
+        sync_segments(ls, id);
+
+        pthread_mutex_lock(&ls->lock);
+        if (ls->segs[id].live == 0) {
+            close(ls->segs[id].fd);
+            ls->segs[id].fd = -1;
+            pthread_mutex_unlock(&ls->lock);
+
+            close(fd);
+            segment_name(id, segname);
+            unlinkat(ls->dirfd, segname, 0);
+            return;
+        }
+
+        if (ls->segs[id].live >= live) {
+            pthread_mutex_unlock(&ls->lock);
+            close(fd);
+            return;
+        }
+        pthread_mutex_unlock(&ls->lock);
+        close(fd);
+    }
+}
+
+// compactor thread. every COMPACT_INTERVAL seconds it compacts the sealed
+// segments that are less than half live. the active segment is never
+// compacted
+//
+// arg: log store
+//
+static void *compact_segments(void *arg) {
+    logstore_t *ls = (logstore_t *) arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&ls->lock);
+    while (ls->stopping == false) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += COMPACT_INTERVAL;
+        pthread_cond_timedwait(&ls->wake, &ls->lock, &deadline);
+
+        for (uint32_t id = 0; id + 1 < ls->nsegs && ls->stopping == false; id++) {
+            segment_t *seg = &ls->segs[id];
+
+            if (seg->fd >= 0 && (seg->live == 0 || seg->live * 2 < seg->tail)) {
+                pthread_mutex_unlock(&ls->lock);
+                compact_segment(ls, id);
+                pthread_mutex_lock(&ls->lock);
+            }
+        }
+    }
+    pthread_mutex_unlock(&ls->lock);
+
+    return NULL;
+}
+
+// adds a committed record found in a segment to the index, unless the
+// index already has a newer version of the object
+//
+static int recover_record(logstore_t *ls, char *name, uint32_t id, off_t off, record_t *hdr) {
+    logentry_t *e = index_find(ls, name);
+
+    if (e != NULL && e->seq >= hdr->seq) {
+        return 0;
+    }
+
+    if (e == NULL && (e = index_add(ls, name)) == NULL) {
+        return -1;
+    }
+
+    index_point(ls, e, id, off, record_len(hdr->namelen, hdr->reserved));
+    e->size = hdr->size;
+    e->seq = hdr->seq;
+    e->mtime = (struct timespec) { .tv_sec = hdr->sec, .tv_nsec = hdr->nsec };
+    if (hdr->seq > ls->seq) {
+        ls->seq = hdr->seq;
+    }
+
+    return 0;
+}
+
+// walks the records of a segment, adding the committed ones to the index.
+// the walk stops at the first header that is not whole
+//
+static int scan_segment(logstore_t *ls, uint32_t id) {
+    char name[MAX_NAME_LEN + 1];
+    int fd = ls->segs[id].fd;
+    off_t off = 0, size = lseek(fd, 0, SEEK_END);
+    record_t hdr;
+
+    while (off + (off_t) sizeof hdr <= size && pread(fd, &hdr, sizeof hdr, off) == sizeof hdr
+           && hdr.magic == LOG_MAGIC && hdr.namelen > 0 && hdr.namelen <= MAX_NAME_LEN
+           && hdr.size <= hdr.reserved) {
+        if ((hdr.flags & RECORD_COMMITTED)
+            && record_data(off, hdr.namelen) + (off_t) hdr.size <= size
+            && pread(fd, name, hdr.namelen, off + sizeof hdr) == hdr.namelen) {
+            name[hdr.namelen] = '\0';
+            if (recover_record(ls, name, id, off, &hdr) < 0) {
+                return -1;
+            }
+        }
+
+        off += record_len(hdr.namelen, hdr.reserved);
+    }
+
+    ls->segs[id].tail = off;
+    return 0;
+}
+
+// rebuilds the index from the segments in the working directory, oldest
+// first. returns 0 on success, -1 on failure
+//
+static int recover_segments(logstore_t *ls) {
+    char segname[SEGMENT_NAMESIZE];
+    uint32_t id, nsegs = 0;
+    struct dirent *de;
+    DIR *dir;
+
+    dir = opendir(".");
+    if (dir == NULL) {
+        return -1;
+    }
+
+    while ((de = readdir(dir)) != NULL) {
+        if (is_segment_name(de->d_name, &id) && id + 1 > nsegs) {
+            nsegs = id + 1;
+        }
+    }
+    closedir(dir);
+
+    if (nsegs > 0 && grow_segments(ls, nsegs + 16) < 0) {
+        return -1;
+    }
+
+    for (id = 0; id < nsegs; id++) {
+        segment_name(id, segname);
+        ls->segs[id] = (segment_t) { .fd = openat(ls->dirfd, segname, O_RDWR | O_CLOEXEC) };
+        ls->nsegs = id + 1;
+
+        if (ls->segs[id].fd < 0 && errno != ENOENT) {
+            return -1;
+        }
+
+        if (ls->segs[id].fd >= 0 && scan_segment(ls, id) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// frees the index and closes the segments, the compactor must not be
+// running
+//
+static void logstore_free(logstore_t *ls) {
+    for (size_t i = 0; ls->buckets != NULL && i < ls->nbuckets; i++) {
+        logentry_t *e = ls->buckets[i];
+
+        while (e != NULL) {
+            logentry_t *next = e->next;
+            free(e->name);
+            free(e);
+            e = next;
+        }
+    }
+
+    for (uint32_t i = 0; i < ls->nsegs; i++) {
+        if (ls->segs[i].fd >= 0) {
+            close(ls->segs[i].fd);
+        }
+    }
+
+    if (ls->dirfd >= 0) {
+        close(ls->dirfd);
+    }
+
+    pthread_cond_destroy(&ls->wake);
+    pthread_mutex_destroy(&ls->lock);
+    free(ls->buckets);
+    free(ls->segs);
+    free(ls);
+}
+
+static void logstore_destroy(store_t *store) {
+    logstore_t *ls = (logstore_t *) store;
+
+    pthread_mutex_lock(&ls->lock);
+    ls->stopping = true;
+    pthread_cond_signal(&ls->wake);
+    pthread_mutex_unlock(&ls->lock);
+
+    pthread_join(ls->compactor, NULL);
+    logstore_free(ls);
+}
+
+static const storeops_t logstore_ops = {
+    .open = logstore_open,
+    .stat = logstore_stat,
+    .check = logstore_check,
+    .stage = logstore_stage,
+    .commit = logstore_commit,
+    .refresh = logstore_refresh,
+    .openw = logstore_openw,
+    .destroy = logstore_destroy,
+};
+
+// creates a log store in the working directory, recovering the objects of
+// the segments already there. new records go to a fresh segment
+//
+// segsize: size a segment is sealed at
+//
+store_t *logstore_create(off_t segsize) {
+    logstore_t *ls = (logstore_t *) calloc(1, sizeof(logstore_t));
+    if (ls == NULL) {
+        return NULL;
+    }
+
+    ls->store.ops = &logstore_ops;
+    ls->segsize = segsize;
+    ls->lock = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    ls->wake = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+    ls->nbuckets = INITIAL_BUCKETS;
+    ls->buckets = (logentry_t **) calloc(ls->nbuckets, sizeof(logentry_t *));
+    ls->dirfd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (ls->buckets == NULL || ls->dirfd < 0 || recover_segments(ls) < 0 || add_segment(ls) < 0
+        || pthread_create(&ls->compactor, NULL, compact_segments, ls) != 0) {
+        logstore_free(ls);
+        return NULL;
+    }
+
+    return &ls->store;
+}
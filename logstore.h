@@ -0,0 +1,8 @@
+#ifndef __LOGSTORE_H__
+#define __LOGSTORE_H__
+
+#include "store.h"
+
+store_t *logstore_create(off_t segsize);
+
+#endif
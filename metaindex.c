@@ -0,0 +1,353 @@
+#include "metaindex.h"
+#include "util.h"
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// an index of the metadata of every object in the working directory, so
+// that lookups of objects, and of missing objects in particular, need no
+// syscall. it is filled by a scan of the directory at startup and kept up
+// to date by the commits of the server, which has to be the only writer
+// to the directory. a hash table of entries under one rwlock, which is
+// doubled in size whenever it holds more entries than buckets
+
+typedef struct metaentry_t metaentry_t;
+
+struct metaentry_t {
+    metaentry_t *next;
+    char *name;
+    off_t size;
+    ino_t ino;
+    mode_t mode;
+    struct timespec mtime;
+};
+
+struct metaindex_t {
+    metaentry_t **buckets;
+    size_t nbuckets, nentries;
+    pthread_rwlock_t lock;
+};
+
+typedef struct {
+    char **paths;
+    size_t npaths, cappaths;
+} namelist_t;
+
+typedef struct {
+    metaindex_t *index;
+    namelist_t *list;
+    int first, stride;
+    int rc;
+} scanner_t;
+
+static metaentry_t *metaindex_find(metaindex_t *index, char *name) {
+    metaentry_t *e = index->buckets[strhash(name) % index->nbuckets];
+
+    while (e != NULL && strcmp(e->name, name) != 0) {
+        e = e->next;
+    }
+
+    return e;
+}
+
+// doubles the number of buckets, keeping the longer chains if there is no
+// memory for more. the caller holds the write lock
+//
+static void metaindex_grow(metaindex_t *index) {
+    size_t nbuckets = index->nbuckets * 2;
+    metaentry_t **buckets = (metaentry_t **) calloc(nbuckets, sizeof(metaentry_t *));
+    if (buckets == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < index->nbuckets; i++) {
+        metaentry_t *e = index->buckets[i];
+
+        while (e != NULL) {
+            metaentry_t *next = e->next;
+            size_t b = strhash(e->name) % nbuckets;
+
+            e->next = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+
+    free(index->buckets);
+    index->buckets = buckets;
+    index->nbuckets = nbuckets;
+}
+
+// creates an empty index
+//
+// nbuckets: initial number of hash buckets
+//
+metaindex_t *metaindex_create(size_t nbuckets) {
+    metaindex_t *index = (metaindex_t *) malloc(sizeof(metaindex_t));
+    if (index == NULL) {
+        return NULL;
+    }
+
+    index->buckets = (metaentry_t **) calloc(nbuckets, sizeof(metaentry_t *));
+    if (index->buckets == NULL) {
+        free(index);
+        return NULL;
+    }
+
+    index->nbuckets = nbuckets;
+    index->nentries = 0;
+    pthread_rwlock_init(&index->lock, NULL);
+    return index;
+}
+
+void metaindex_destroy(metaindex_t **index) {
+    if (index && *index) {
+        for (size_t i = 0; i < (*index)->nbuckets; i++) {
+            metaentry_t *e = (*index)->buckets[i];
+
+            while (e != NULL) {
+                metaentry_t *next = e->next;
+                free(e->name);
+                free(e);
+                e = next;
+            }
+        }
+
+        pthread_rwlock_destroy(&(*index)->lock);
+        free((*index)->buckets);
+        free(*index);
+        *index = NULL;
+    }
+}
+
+// scanner thread, stats every stride-th path of the listing from first on
+// and adds it to the index under its file name
+//
+// arg: scanner struct of the thread
+//
+static void *scan_names(void *arg) {
+    scanner_t *s = (scanner_t *) arg;
+    struct stat statbuf;
+    char *name;
+
+    for (size_t i = s->first; i < s->list->npaths; i += s->stride) {
+        // paths that vanished since the listing are not objects anymore
+        if (stat(s->list->paths[i], &statbuf) < 0) {
+            continue;
+        }
+
+        name = strrchr(s->list->paths[i], '/');
+        name = name != NULL ? name + 1 : s->list->paths[i];
+        if (metaindex_update(s->index, name, &statbuf) < 0) {
+            s->rc = -1;
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+// adds the entries of a directory to a listing, as paths relative to the
+// working directory. with shards set, only the entries named by two hex
+// digits are listed. returns 0 on success, -1 on failure
+//
+// list  : listing
+// dir   : directory to list
+// shards: list shard directories only
+//
+static int list_dir(namelist_t *list, char *dir, bool shards) {
+    char path[PATH_MAX];
+    struct dirent *de;
+    DIR *d = opendir(dir);
+
+    // a "shard" that is a regular file is no shard
+    if (d == NULL) {
+        return shards ? 0 : -1;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+
+        if (shards
+            && (strlen(de->d_name) != 2 || !isxdigit((unsigned char) de->d_name[0])
+                || !isxdigit((unsigned char) de->d_name[1]))) {
+            continue;
+        }
+
+        if (list->npaths == list->cappaths) {
+            size_t cappaths = list->cappaths * 2 + 1024;
+            char **more = (char **) realloc(list->paths, cappaths * sizeof(char *));
+            if (more == NULL) {
+                closedir(d);
+                return -1;
+            }
+            list->paths = more;
+            list->cappaths = cappaths;
+        }
+
+        if (strcmp(dir, ".") == 0) {
+            snprintf(path, sizeof path, "%s", de->d_name);
+        } else {
+            snprintf(path, sizeof path, "%s/%s", dir, de->d_name);
+        }
+
+        if ((list->paths[list->npaths] = strdup(path)) == NULL) {
+            closedir(d);
+            return -1;
+        }
+        list->npaths++;
+    }
+
+    closedir(d);
+    return 0;
+}
+
+// lists the objects of the working directory, or of the shards two
+// levels below it if sharded
+//
+static int list_objects(namelist_t *list, bool sharded) {
+    namelist_t top = { 0 }, mid = { 0 };
+    int rc = 0;
+
+    if (sharded == false) {
+        return list_dir(list, ".", false);
+    }
+
+    rc = list_dir(&top, ".", true);
+    for (size_t i = 0; rc == 0 && i < top.npaths; i++) {
+        rc = list_dir(&mid, top.paths[i], true);
+    }
+
+    for (size_t i = 0; rc == 0 && i < mid.npaths; i++) {
+        rc = list_dir(list, mid.paths[i], false);
+    }
+
+    for (size_t i = 0; i < top.npaths; i++) {
+        free(top.paths[i]);
+    }
+
+    for (size_t i = 0; i < mid.npaths; i++) {
+        free(mid.paths[i]);
+    }
+
+    free(top.paths);
+    free(mid.paths);
+    return rc;
+}
+
+// fills the index with the objects in the working directory. the objects
+// are listed first and then stat'd by nthreads threads in parallel, which
+// keeps the disk busy when the inodes are not cached. returns 0 on
+// success, -1 on failure
+//
+// index   : metadata index
+// nthreads: number of threads statting objects
+// sharded : whether objects are kept in hashed subdirectories
+//
+int metaindex_scan(metaindex_t *index, int nthreads, bool sharded) {
+    scanner_t *scanners = (scanner_t *) calloc(nthreads, sizeof(scanner_t));
+    pthread_t *threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+    namelist_t list = { 0 };
+    int rc = -1, started = 0;
+
+    if (scanners == NULL || threads == NULL || list_objects(&list, sharded) < 0) {
+        goto out;
+    }
+
+    rc = 0;
+    for (int i = 0; i < nthreads; i++) {
+        scanners[i] = (scanner_t) { .index = index, .list = &list, .first = i, .stride = nthreads };
+        if (pthread_create(&threads[i], NULL, scan_names, &scanners[i]) != 0) {
+            rc = -1;
+            break;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        if (scanners[i].rc < 0) {
+            rc = -1;
+        }
+    }
+
+out:
+    for (size_t i = 0; i < list.npaths; i++) {
+        free(list.paths[i]);
+    }
+
+    free(list.paths);
+    free(threads);
+    free(scanners);
+    return rc;
+}
+
+// looks an object up. returns false if there is no such object, or true
+// and fills in its size, inode, mode and mtime
+//
+// index  : metadata index
+// name   : object name
+// statbuf: stat struct filled in for the object
+//
+bool metaindex_lookup(metaindex_t *index, char *name, struct stat *statbuf) {
+    metaentry_t *e;
+
+    pthread_rwlock_rdlock(&index->lock);
+    e = metaindex_find(index, name);
+    if (e != NULL) {
+        memset(statbuf, 0, sizeof(struct stat));
+        statbuf->st_size = e->size;
+        statbuf->st_ino = e->ino;
+        statbuf->st_mode = e->mode;
+        statbuf->st_mtim = e->mtime;
+    }
+    pthread_rwlock_unlock(&index->lock);
+
+    return e != NULL;
+}
+
+// records the metadata of a new or changed object. returns 0 on success,
+// -1 if there is no memory for a new entry
+//
+// index  : metadata index
+// name   : object name
+// statbuf: the object's metadata
+//
+int metaindex_update(metaindex_t *index, char *name, struct stat *statbuf) {
+    metaentry_t *e;
+
+    pthread_rwlock_wrlock(&index->lock);
+    e = metaindex_find(index, name);
+    if (e == NULL) {
+        e = (metaentry_t *) calloc(1, sizeof(metaentry_t));
+        if (e == NULL || (e->name = strdup(name)) == NULL) {
+            pthread_rwlock_unlock(&index->lock);
+            free(e);
+            return -1;
+        }
+
+        if (++index->nentries > index->nbuckets) {
+            metaindex_grow(index);
+        }
+
+        size_t b = strhash(name) % index->nbuckets;
+        e->next = index->buckets[b];
+        index->buckets[b] = e;
+    }
+
+    e->size = statbuf->st_size;
+    e->ino = statbuf->st_ino;
+    e->mode = statbuf->st_mode;
+    e->mtime = statbuf->st_mtim;
+    pthread_rwlock_unlock(&index->lock);
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef __METAINDEX_H__
+#define __METAINDEX_H__
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+typedef struct metaindex_t metaindex_t;
+
+metaindex_t *metaindex_create(size_t nbuckets);
+
+void metaindex_destroy(metaindex_t **index);
+
+int metaindex_scan(metaindex_t *index, int nthreads, bool sharded);
+
+bool metaindex_lookup(metaindex_t *index, char *name, struct stat *statbuf);
+
+int metaindex_update(metaindex_t *index, char *name, struct stat *statbuf);
+
+#endif
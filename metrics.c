@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+
+#include "metrics.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// latency histograms and counters of the server, served in the prometheus
+// text format on a port of their own.
+//
+// every worker records into its own set of histograms, so recording is an
+// uncontended atomic add, and a scrape merges the sets of all workers. a
+// histogram is log-linear like an HDR histogram: values are nanoseconds,
+// every power of two is split into SUB_COUNT buckets, so a value is known
+// to within 1/SUB_COUNT of itself from 1ns up to 2^MAX_EXP ns (about 18
+// minutes), where values are clamped. a scrape reports the buckets at the
+// powers of two from EXPORT_MIN to EXPORT_MAX, which the buckets line up
+// with exactly.
+//
+// requests are timed in four ways: how long they wait in the work queue
+// for a worker, how long they stay suspended waiting for their socket or
+// the syncer, how long they spend in each state of the request state
+// machine while a worker runs them, and how long they take from being
+// accepted to being done, by method and status
+
+#define SUB_BITS     4
+#define SUB_COUNT    (1 << SUB_BITS)
+#define MAX_EXP      40
+#define HIST_BUCKETS ((MAX_EXP - SUB_BITS + 1) * SUB_COUNT)
+#define EXPORT_MIN   10
+#define EXPORT_MAX   36
+#define NSTATES      (DONE + 1)
+#define NMETHODS     (HEAD + 1)
+#define NSTATUSES    13
+#define SCRAPE_SIZE  1024
+
+typedef struct {
+    _Atomic uint64_t counts[HIST_BUCKETS];
+    _Atomic uint64_t sum;
+} hist_t;
+
+typedef struct {
+    hist_t queue;
+    hist_t suspended;
+    hist_t states[NSTATES];
+    hist_t totals[NMETHODS][NSTATUSES];
+    _Atomic uint64_t suspensions;
+} workerstats_t;
+
+struct metrics_t {
+    workerstats_t *workers;
+    int nworkers;
+    atomic_int next;
+    _Atomic uint64_t accepted;
+    int listenfd;
+    atomic_bool stopping;
+    pthread_t thread;
+};
+
+// the set of histograms of the calling worker
+static _Thread_local workerstats_t *local_stats;
+
+static const char *state_names[NSTATES] = { "recv_header", "parse_header", "handle_request",
+    "open_file", "send_ack", "send_body", "recv_rem_body", "recv_body", "write_body", "sync_body",
+    "done" };
+
+static const char *method_names[NMETHODS] = { "NONE", "GET", "PUT", "APPEND", "HEAD" };
+
+// the statuses requests are counted under, anything else is "other"
+static const status_t statuses[NSTATUSES - 1] = { OK, CREATED, PARTIAL, NOT_MODIFIED,
+    BAD_REQUEST, FORBIDDEN, FILE_NOT_FOUND, BAD_RANGE, EXPECT_FAILED, INT_ERR, NOT_IMPL,
+    NO_SPACE };
+
+// returns the current monotonic time in nanoseconds
+//
+uint64_t metrics_clock(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static size_t bucket_of(uint64_t value) {
+    int exp;
+
+    if (value >= (1ULL << MAX_EXP)) {
+        value = (1ULL << MAX_EXP) - 1;
+    }
+
+    if (value < SUB_COUNT) {
+        return value;
+    }
+
+    exp = 63 - __builtin_clzll(value);
+    return (exp - SUB_BITS + 1) * SUB_COUNT + ((value >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+static void record(hist_t *hist, uint64_t value) {
+    atomic_fetch_add_explicit(&hist->counts[bucket_of(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+}
+
+// returns the histograms of the calling worker. workers take a set each
+// the first time they record, any beyond the number of sets share the last
+//
+static workerstats_t *worker_stats(metrics_t *m) {
+    int i;
+
+    if (local_stats == NULL) {
+        i = atomic_fetch_add(&m->next, 1);
+        local_stats = &m->workers[i < m->nworkers ? i : m->nworkers - 1];
+    }
+
+    return local_stats;
+}
+
+static size_t status_index(status_t status) {
+    size_t i = 0;
+
+    for (; i < NSTATUSES - 1 && statuses[i] != status; i++) {
+    }
+
+    return i;
+}
+
+// counts an accepted connection
+//
+void metrics_accepted(metrics_t *m) {
+    atomic_fetch_add_explicit(&m->accepted, 1, memory_order_relaxed);
+}
+
+// records how long a request waited in the work queue, and how long it
+// was suspended before that, once a worker takes it up
+//
+// m  : metrics
+// req: request being taken up
+//
+void metrics_dequeued(metrics_t *m, request_t *req) {
+    workerstats_t *stats = worker_stats(m);
+    uint64_t now = metrics_clock();
+
+    record(&stats->queue, now - req->timing.queued);
+    if (req->timing.suspended != 0) {
+        record(&stats->suspended, req->timing.queued - req->timing.suspended);
+        req->timing.suspended = 0;
+    }
+
+    req->timing.mark = now;
+    req->timing.state = req->state;
+}
+
+// records the time a request spent in the state it was last seen in if it
+// has moved on to another one since
+//
+// m  : metrics
+// req: request being run
+//
+void metrics_track(metrics_t *m, request_t *req) {
+    uint64_t now;
+
+    if (req->state == req->timing.state) {
+        return;
+    }
+
+    now = metrics_clock();
+    record(&worker_stats(m)->states[req->timing.state], now - req->timing.mark);
+    req->timing.mark = now;
+    req->timing.state = req->state;
+}
+
+// records the rest of a worker's run of a request. a suspended request
+// starts its suspension, one that is done has its total latency recorded
+//
+// m  : metrics
+// req: request the worker ran
+//
+void metrics_yield(metrics_t *m, request_t *req) {
+    workerstats_t *stats = worker_stats(m);
+    uint64_t now = metrics_clock(), start;
+    status_t status;
+
+    record(&stats->states[req->timing.state], now - req->timing.mark);
+    if (req->status == SUSPEND) {
+        atomic_fetch_add_explicit(&stats->suspensions, 1, memory_order_relaxed);
+        req->timing.suspended = now;
+        return;
+    }
+
+    // requests that were never logged count under the status they ended in
+    status = req->timing.result != SUSPEND ? req->timing.result : req->status;
+    start = (uint64_t) req->start.tv_sec * 1000000000 + req->start.tv_nsec;
+    record(&stats->totals[req->reqline.method][status_index(status)], now - start);
+}
+
+// sums the histograms at the same offset in the sets of every worker.
+// returns the number of values recorded
+//
+// offset: offset of the histogram in workerstats_t
+// counts: HIST_BUCKETS counts to fill
+// sum   : sum of the values to fill
+//
+static uint64_t merge_hist(metrics_t *m, size_t offset, uint64_t *counts, uint64_t *sum) {
+    uint64_t total = 0;
+
+    memset(counts, 0, HIST_BUCKETS * sizeof(uint64_t));
+    *sum = 0;
+    for (int w = 0; w < m->nworkers; w++) {
+        hist_t *hist = (hist_t *) ((char *) &m->workers[w] + offset);
+        for (size_t i = 0; i < HIST_BUCKETS; i++) {
+            counts[i] += atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+        }
+        *sum += atomic_load_explicit(&hist->sum, memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        total += counts[i];
+    }
+
+    return total;
+}
+
+// writes a merged histogram as a prometheus histogram in seconds. empty
+// histograms are left out
+//
+// name  : metric name
+// labels: labels of the histogram, without braces, or an empty string
+// offset: offset of the histogram in workerstats_t
+//
+static void write_hist(metrics_t *m, FILE *out, const char *name, const char *labels,
+    size_t offset) {
+    uint64_t counts[HIST_BUCKETS], sum, total, below = 0;
+    const char *sep = labels[0] != '\0' ? "," : "";
+    size_t i = 0;
+
+    total = merge_hist(m, offset, counts, &sum);
+    if (total == 0) {
+        return;
+    }
+
+    // the first bucket of every power of two from SUB_BITS up starts
+    // exactly at it
+    for (int exp = EXPORT_MIN; exp <= EXPORT_MAX; exp++) {
+        for (; i < (size_t) (exp - SUB_BITS + 1) * SUB_COUNT; i++) {
+            below += counts[i];
+        }
+        fprintf(out, "%s_bucket{%s%sle=\"%.9g\"} %" PRIu64 "\n", name, labels, sep,
+            (double) (1ULL << exp) / 1e9, below);
+    }
+
+    fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, sep, total);
+    fprintf(out, "%s_sum{%s} %.9f\n", name, labels, (double) sum / 1e9);
+    fprintf(out, "%s_count{%s} %" PRIu64 "\n", name, labels, total);
+}
+
+static void write_header(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// writes every metric in the prometheus text format
+//
+static void write_metrics(metrics_t *m, FILE *out) {
+    uint64_t suspensions = 0;
+    char labels[64];
+
+    write_header(out, "httpserver_connections_total", "counter", "Connections accepted.");
+    fprintf(out, "httpserver_connections_total %" PRIu64 "\n", atomic_load(&m->accepted));
+
+    for (int w = 0; w < m->nworkers; w++) {
+        suspensions += atomic_load(&m->workers[w].suspensions);
+    }
+    write_header(out, "httpserver_suspensions_total", "counter",
+        "Times requests suspended to wait for their socket.");
+    fprintf(out, "httpserver_suspensions_total %" PRIu64 "\n", suspensions);
+
+    write_header(out, "httpserver_queue_wait_seconds", "histogram",
+        "Time requests wait in the work queue for a worker.");
+    write_hist(m, out, "httpserver_queue_wait_seconds", "", offsetof(workerstats_t, queue));
+
+    write_header(out, "httpserver_suspended_seconds", "histogram",
+        "Time requests stay suspended waiting for their socket.");
+    write_hist(m, out, "httpserver_suspended_seconds", "", offsetof(workerstats_t, suspended));
+
+    write_header(out, "httpserver_state_seconds", "histogram",
+        "Time workers spend on requests in each state.");
+    for (int s = 0; s < NSTATES; s++) {
+        snprintf(labels, sizeof(labels), "state=\"%s\"", state_names[s]);
+        write_hist(m, out, "httpserver_state_seconds", labels,
+            offsetof(workerstats_t, states) + s * sizeof(hist_t));
+    }
+
+    write_header(out, "httpserver_request_seconds", "histogram",
+        "Time from accepting a request to finishing it.");
+    for (int mt = 0; mt < NMETHODS; mt++) {
+        for (int st = 0; st < NSTATUSES; st++) {
+            if (st < NSTATUSES - 1) {
+                snprintf(labels, sizeof(labels), "method=\"%s\",code=\"%d\"", method_names[mt],
+                    statuses[st]);
+            } else {
+                snprintf(labels, sizeof(labels), "method=\"%s\",code=\"other\"", method_names[mt]);
+            }
+            write_hist(m, out, "httpserver_request_seconds", labels,
+                offsetof(workerstats_t, totals) + (mt * NSTATUSES + st) * sizeof(hist_t));
+        }
+    }
+}
+
+static void send_all(int fd, char *buf, size_t len) {
+    ssize_t nbytes;
+
+    for (; len > 0; buf += nbytes, len -= nbytes) {
+        nbytes = send(fd, buf, len, MSG_NOSIGNAL);
+        if (nbytes <= 0) {
+            return;
+        }
+    }
+}
+
+// answers one scrape. only GET /metrics is served
+//
+static void serve_scrape(metrics_t *m, int connfd) {
+    char req[SCRAPE_SIZE + 1], head[128], *body = NULL;
+    size_t len = 0, bodylen = 0;
+    ssize_t nbytes;
+    FILE *out;
+
+    while (len < SCRAPE_SIZE) {
+        nbytes = recv(connfd, req + len, SCRAPE_SIZE - len, 0);
+        if (nbytes <= 0) {
+            return;
+        }
+        len += nbytes;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL) {
+            break;
+        }
+    }
+
+    if (strncmp(req, "GET /metrics ", 13) != 0) {
+        send_all(connfd, NOT_FOUND_MSG, strlen(NOT_FOUND_MSG));
+        return;
+    }
+
+    out = open_memstream(&body, &bodylen);
+    if (out == NULL) {
+        send_all(connfd, INTERNAL_MSG, strlen(INTERNAL_MSG));
+        return;
+    }
+    write_metrics(m, out);
+    fclose(out);
+
+    snprintf(head, sizeof(head),
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+        bodylen);
+    send_all(connfd, head, strlen(head));
+    send_all(connfd, body, bodylen);
+    free(body);
+}
+
+// scrape thread. answers scrapes one at a time until the listening socket
+// is shut down
+//
+// arg: metrics
+//
+static void *serve_scrapes(void *arg) {
+    metrics_t *m = (metrics_t *) arg;
+    struct timeval timeout = { .tv_sec = 1 };
+    int connfd;
+
+    while (atomic_load(&m->stopping) == false) {
+        connfd = accept(m->listenfd, NULL, NULL);
+        if (connfd < 0) {
+            continue;
+        }
+
+        // a scraper that does not send its request is not waited on
+        setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        serve_scrape(m, connfd);
+        close(connfd);
+    }
+
+    return NULL;
+}
+
+static int listen_local(uint16_t port) {
+    struct sockaddr_in addr = { 0 };
+    int fd = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// creates the metrics of a server and starts serving them on a port of
+// the loopback interface
+//
+// nworkers: number of worker threads that record
+// port    : port to serve scrapes on
+//
+metrics_t *metrics_create(int nworkers, uint16_t port) {
+    metrics_t *m = (metrics_t *) malloc(sizeof(metrics_t));
+    if (m == NULL) {
+        return NULL;
+    }
+
+    // the sets are large and mostly never touched, calloc leaves the pages
+    // of the unused histograms unbacked
+    m->workers = (workerstats_t *) calloc(nworkers, sizeof(workerstats_t));
+    if (m->workers == NULL) {
+        free(m);
+        return NULL;
+    }
+
+    m->nworkers = nworkers;
+    atomic_init(&m->next, 0);
+    atomic_init(&m->accepted, 0);
+    atomic_init(&m->stopping, false);
+
+    m->listenfd = listen_local(port);
+    if (m->listenfd < 0) {
+        free(m->workers);
+        free(m);
+        return NULL;
+    }
+
+    if (pthread_create(&m->thread, NULL, serve_scrapes, m) != 0) {
+        close(m->listenfd);
+        free(m->workers);
+        free(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+// stops serving scrapes and frees the metrics. the workers must have been
+// stopped before this
+//
+void metrics_destroy(metrics_t **m) {
+    if (m && *m) {
+        atomic_store(&(*m)->stopping, true);
+        shutdown((*m)->listenfd, SHUT_RDWR);
+        pthread_join((*m)->thread, NULL);
+        close((*m)->listenfd);
+        free((*m)->workers);
+        free(*m);
+        *m = NULL;
+    }
+}
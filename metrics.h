@@ -0,0 +1,23 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "request.h"
+#include <stdint.h>
+
+typedef struct metrics_t metrics_t;
+
+metrics_t *metrics_create(int nworkers, uint16_t port);
+
+void metrics_destroy(metrics_t **m);
+
+uint64_t metrics_clock(void);
+
+void metrics_accepted(metrics_t *m);
+
+void metrics_dequeued(metrics_t *m, request_t *req);
+
+void metrics_track(metrics_t *m, request_t *req);
+
+void metrics_yield(metrics_t *m, request_t *req);
+
+#endif
@@ -0,0 +1,236 @@
+#include "mmapcache.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// a direct mapped cache of read-only file mappings. every slot holds at most
+// one mapping, and the cache owns one reference to it. a generation counter
+// per slot is bumped whenever an object hashing to that slot is replaced so
+// that a mapping created from a file opened before the replacement is never
+// published to later readers
+
+struct mmapcache_t {
+    mapping_t **slots;
+    uint64_t *gens;
+    size_t nslots, maxsize;
+    pthread_mutex_t lock;
+};
+
+static mapping_t *mapping_create(mmapcache_t *cache, char *name, int fd, struct stat *statbuf) {
+    size_t size = statbuf->st_size;
+    mapping_t *map = (mapping_t *) malloc(sizeof(mapping_t));
+    if (map == NULL) {
+        return NULL;
+    }
+
+    map->addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map->addr == MAP_FAILED) {
+        free(map);
+        return NULL;
+    }
+
+    map->name = strdup(name);
+    if (map->name == NULL) {
+        munmap(map->addr, size);
+        free(map);
+        return NULL;
+    }
+
+    map->cache = cache;
+    map->size = size;
+    map->ino = statbuf->st_ino;
+    map->mtime = statbuf->st_mtim;
+    map->refs = 1;
+    return map;
+}
+
+static void mapping_destroy(mapping_t *map) {
+    munmap(map->addr, map->size);
+    free(map->name);
+    free(map);
+}
+
+// drops a reference to a mapping, the caller must hold the cache lock.
+// returns true if that was the last reference and the mapping must be
+// destroyed (outside of the lock)
+//
+static bool mapping_unref(mapping_t *map) {
+    return --map->refs == 0;
+}
+
+static size_t mmapcache_slot(mmapcache_t *cache, char *name) {
+    return strhash(name) % cache->nslots;
+}
+
+// creates a mapping cache with a fixed number of slots that only maps
+// files of up to maxsize bytes
+//
+// nslots : number of mappings the cache can hold
+// maxsize: largest file size that will be mapped
+//
+mmapcache_t *mmapcache_create(size_t nslots, size_t maxsize) {
+    mmapcache_t *cache = (mmapcache_t *) malloc(sizeof(mmapcache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->slots = (mapping_t **) calloc(nslots, sizeof(mapping_t *));
+    cache->gens = (uint64_t *) calloc(nslots, sizeof(uint64_t));
+    if (cache->slots == NULL || cache->gens == NULL) {
+        free(cache->slots);
+        free(cache->gens);
+        free(cache);
+        return NULL;
+    }
+
+    cache->nslots = nslots;
+    cache->maxsize = maxsize;
+    cache->lock = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    return cache;
+}
+
+// drops the cache's references to its mappings and frees the cache. any
+// connection still holding a mapping must have been destroyed before this
+//
+void mmapcache_destroy(mmapcache_t **cache) {
+    if (cache && *cache) {
+        for (size_t i = 0; i < (*cache)->nslots; i++) {
+            if ((*cache)->slots[i] != NULL && mapping_unref((*cache)->slots[i])) {
+                mapping_destroy((*cache)->slots[i]);
+            }
+        }
+
+        pthread_mutex_destroy(&(*cache)->lock);
+        free((*cache)->slots);
+        free((*cache)->gens);
+        free(*cache);
+        *cache = NULL;
+    }
+}
+
+// looks up the mapping of an object and returns it with an extra reference
+// or NULL if it is not cached. the slot generation is returned through gen
+// so a miss can later be inserted with mmapcache_insert
+//
+// cache: mapping cache
+// name : object name
+// gen  : slot generation at the time of the lookup
+//
+mapping_t *mmapcache_lookup(mmapcache_t *cache, char *name, uint64_t *gen) {
+    size_t slot = mmapcache_slot(cache, name);
+    mapping_t *map;
+
+    pthread_mutex_lock(&cache->lock);
+    *gen = cache->gens[slot];
+    map = cache->slots[slot];
+    if (map != NULL && strcmp(map->name, name) == 0) {
+        map->refs++;
+    } else {
+        map = NULL;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return map;
+}
+
+// maps an open file and returns the mapping with a reference for the caller,
+// or NULL if the file is empty, too large, or cannot be mapped. the mapping is
+// only published in the cache if the object was not replaced since the lookup
+// that produced gen
+//
+// cache  : mapping cache
+// name   : object name
+// fd     : file descriptor of the opened object
+// statbuf: stat struct of the opened object
+// gen    : slot generation returned by mmapcache_lookup
+//
+mapping_t *mmapcache_insert(
+    mmapcache_t *cache, char *name, int fd, struct stat *statbuf, uint64_t gen) {
+    size_t slot = mmapcache_slot(cache, name);
+    mapping_t *map, *evict = NULL;
+
+    if (statbuf->st_size == 0 || (size_t) statbuf->st_size > cache->maxsize) {
+        return NULL;
+    }
+
+    // another reader may have published the same version in the meantime
+    pthread_mutex_lock(&cache->lock);
+    map = cache->slots[slot];
+    if (cache->gens[slot] == gen && map != NULL && strcmp(map->name, name) == 0) {
+        map->refs++;
+        pthread_mutex_unlock(&cache->lock);
+        return map;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    map = mapping_create(cache, name, fd, statbuf);
+    if (map == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->gens[slot] == gen) {
+        if (cache->slots[slot] != NULL && mapping_unref(cache->slots[slot])) {
+            evict = cache->slots[slot];
+        }
+
+        cache->slots[slot] = map;
+        map->refs++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (evict != NULL) {
+        mapping_destroy(evict);
+    }
+
+    return map;
+}
+
+// drops the cached mapping of an object that is being replaced or modified.
+// readers already holding the mapping keep it until they release it
+//
+// cache: mapping cache
+// name : object name
+//
+void mmapcache_invalidate(mmapcache_t *cache, char *name) {
+    size_t slot = mmapcache_slot(cache, name);
+    mapping_t *map, *evict = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->gens[slot]++;
+    map = cache->slots[slot];
+    if (map != NULL && strcmp(map->name, name) == 0) {
+        cache->slots[slot] = NULL;
+        if (mapping_unref(map)) {
+            evict = map;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (evict != NULL) {
+        mapping_destroy(evict);
+    }
+}
+
+// releases a reference to a mapping obtained from the cache
+//
+// map: pointer to the mapping, set to NULL
+//
+void mapping_release(mapping_t **map) {
+    if (map && *map) {
+        mmapcache_t *cache = (*map)->cache;
+        bool last;
+
+        pthread_mutex_lock(&cache->lock);
+        last = mapping_unref(*map);
+        pthread_mutex_unlock(&cache->lock);
+
+        if (last) {
+            mapping_destroy(*map);
+        }
+
+        *map = NULL;
+    }
+}
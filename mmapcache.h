@@ -0,0 +1,37 @@
+#ifndef __MMAPCACHE_H__
+#define __MMAPCACHE_H__
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+typedef struct mmapcache_t mmapcache_t;
+
+typedef struct mapping_t mapping_t;
+
+struct mapping_t {
+    mmapcache_t *cache;
+    char *name;
+    uint8_t *addr;
+    size_t size;
+    ino_t ino;
+    struct timespec mtime;
+    int refs;
+};
+
+mmapcache_t *mmapcache_create(size_t nslots, size_t maxsize);
+
+void mmapcache_destroy(mmapcache_t **cache);
+
+mapping_t *mmapcache_lookup(mmapcache_t *cache, char *name, uint64_t *gen);
+
+mapping_t *mmapcache_insert(
+    mmapcache_t *cache, char *name, int fd, struct stat *statbuf, uint64_t gen);
+
+void mmapcache_invalidate(mmapcache_t *cache, char *name);
+
+void mapping_release(mapping_t **map);
+
+#endif
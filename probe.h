@@ -0,0 +1,32 @@
+#ifndef __PROBE_H__
+#define __PROBE_H__
+
+// static tracepoints of the httpserver provider, for bpftrace or perf:
+//
+//     bpftrace -e 'usdt:./httpserver:httpserver:suspend { @[arg1] = count(); }'
+//
+// with sys/sdt.h each probe is a nop and a note in the binary that costs
+// nothing until a tracer attaches. the Makefile defines HAVE_SDT when it
+// finds the header, without it the probes compile to nothing
+//
+// accept(fd)                  connection accepted
+// state(fd, from, to)         request moved on from one state_t to another
+// suspend(fd, state)          request suspended waiting for its socket or the syncer
+// resume(fd)                  suspended request's socket became ready
+// done(fd, method, status)    worker finished a request
+// lock__wait(name, exclusive) object lock requested
+// lock__acquire(name, excl.)  object lock taken
+// lock__release(name)         object lock released
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define PROBE1(name, a)       DTRACE_PROBE1(httpserver, name, a)
+#define PROBE2(name, a, b)    DTRACE_PROBE2(httpserver, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(httpserver, name, a, b, c)
+#else
+#define PROBE1(name, a)       // nothing
+#define PROBE2(name, a, b)    // nothing
+#define PROBE3(name, a, b, c) // nothing
+#endif
+
+#endif
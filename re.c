@@ -1,7 +1,7 @@
 #include "re.h"
 
 #define REQL_RE   "^([A-Za-z]+)\\s+/([a-zA-Z0-9._]+)\\s+(HTTP/1.1)\r\n(\r\n)?"
-#define FIELDS_RE "^([^\r\n]+):\\s+([^\r\n]+)\r\n(\r\n)?"
+#define FIELDS_RE "^([^\r\n:]+):\\s+([^\r\n]+)\r\n(\r\n)?"
 #define END_RE    "\r\n\r\n"
 
 // compiles regular expressions for parsing http headers and returns
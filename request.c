@@ -1,29 +1,91 @@
+#define _GNU_SOURCE
+
 #include "ioutil.h"
 #include "request.h"
 #include "debug.h"
+#include "stats.h"
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #define WAIT_TIME 100
 
-// initializes an http header struct and its members
+// sends smaller than this are cheaper to copy than to pin for zerocopy
+#define ZEROCOPY_MIN 16384
+
+// bytes moved through the body pipe per splice
+#define PIPE_CHUNK (1 << 18)
+
+#define HTTP_DATE_FMT "%a, %d %b %Y %H:%M:%S GMT"
+#define ETAG_SIZE     64
+#define DATE_SIZE     32
+
+// counts a receive from a socket and the bytes it moved
+//
+static inline void count_recv(ssize_t nbytes) {
+    stats_count(STAT_RECVS, 1);
+    if (nbytes > 0) {
+        stats_count(STAT_BYTES_IN, nbytes);
+    }
+}
+
+// counts a send to a socket and the bytes it moved
+//
+static inline void count_send(ssize_t nbytes) {
+    stats_count(STAT_SENDS, 1);
+    if (nbytes > 0) {
+        stats_count(STAT_BYTES_OUT, nbytes);
+    }
+}
+
+// longest object name a request may name, see set_object_limit()
+static size_t max_object_len = DEFAULT_OBJECT_LEN;
+
+// sets the longest object name accepted in a request line, names that are
+// longer are rejected with 400. set once at startup
+//
+// maxlen: maximum object name length
+//
+void set_object_limit(size_t maxlen) {
+    max_object_len = maxlen;
+}
+
+// closes the pipe used to splice a request body into its tmpfile, after
+// which the body is received by copying it through user space
+//
+// req: pointer to request struct
+//
+static void close_body_pipe(request_t *req) {
+    if (req->tmp.pipefd[0] >= 0) {
+        close(req->tmp.pipefd[0]);
+        close(req->tmp.pipefd[1]);
+        req->tmp.pipefd[0] = req->tmp.pipefd[1] = -1;
+    }
+}
+
+// initializes an http header struct and its members. the request starts
+// its clock here, when its connection is accepted
 //
 request_t request_create(void) {
     request_t req = {
         .header = { 0 },
         .reqline = { 0 },
-        .fields = { 0, -1 },
-        .object = { -1, 0, OK },
-        .tmp = { -1, { 0 } },
+        .fields = { .contlen = -1, .since = -1 },
+        .object = { .fd = -1, .status = OK },
+        .tmp = { .fd = -1, .pipefd = { -1, -1 }, .segment = -1 },
         .status = OK,
         .state = RECV_HEADER,
     };
     //request_t req = { { 0 }, { 0 }, { 0, -1 } };
+    clock_gettime(CLOCK_MONOTONIC, &req.start);
     return req;
 }
 
@@ -41,13 +103,24 @@ void request_destroy(request_t *req) {
         free(req->reqline.version);
     }
 
+    if (req->fields.etags != NULL) {
+        free(req->fields.etags);
+    }
+
+    // an in-place APPEND that never committed takes its bytes back out
+    appendslot_abort(&req->tmp.slot);
+
     if (req->tmp.fd > 2) {
         close(req->tmp.fd);
     }
 
+    close_body_pipe(req);
+
     if (req->object.fd > 2) {
         close(req->object.fd);
     }
+
+    mapping_release(&req->object.map);
 }
 
 // recieves an http request from a socket until it has been
@@ -65,6 +138,7 @@ void recv_http_request(int connfd, request_t *req) {
     do {
         nbytes = recv(
             connfd, req->header.buf + req->header.size, REQSIZE - req->header.size, MSG_DONTWAIT);
+        count_recv(nbytes);
         if (nbytes < 0) {
             switch (errno) {
             case EWOULDBLOCK: req->status = SUSPEND; return;
@@ -82,9 +156,17 @@ void recv_http_request(int connfd, request_t *req) {
     req->state = PARSE_HEADER;
 }
 
-int64_t recv_rem_http_body(request_t *req) {
+int64_t recv_rem_http_body(int connfd, request_t *req) {
     ssize_t nbytes = 0;
 
+    // chunked bodies are decoded as they are received, starting with the
+    // bytes that came in with the header
+    if (req->fields.chunked) {
+        req->status = OK;
+        req->state = RECV_BODY;
+        return nbytes;
+    }
+
     if (req->fields.contlen <= 0) {
         req->status = OK;
         req->state = WRITE_BODY;
@@ -102,14 +184,236 @@ int64_t recv_rem_http_body(request_t *req) {
         }
     }
 
+    // the rest of the body is spliced from the socket to the tmpfile through
+    // a pipe if one can be made, otherwise it is copied through user space.
+    // SPLICE_F_NONBLOCK only covers the pipe, reading the socket would still
+    // block the worker unless the socket itself is non-blocking
+    if (pipe2(req->tmp.pipefd, O_CLOEXEC) == 0) {
+        fcntl(req->tmp.pipefd[1], F_SETPIPE_SZ, PIPE_CHUNK);
+        set_nonblocking(connfd);
+    } else {
+        req->tmp.pipefd[0] = req->tmp.pipefd[1] = -1;
+    }
+
     req->status = OK;
     req->state = RECV_BODY;
     return nbytes;
 }
 
+// moves bytes that were spliced into the body pipe on to the tmpfile.
+// if the tmpfile does not support splicing the bytes are copied out of
+// the pipe instead. returns 0 on success, -1 on failure
+//
+// req   : pointer to request struct
+// nbytes: number of bytes in the pipe
+//
+static int drain_body_pipe(request_t *req, ssize_t nbytes) {
+    uint8_t buffer[BLOCK];
+    ssize_t wbytes;
+
+    while (nbytes > 0) {
+        wbytes = splice(req->tmp.pipefd[0], NULL, req->tmp.fd, NULL, nbytes, SPLICE_F_MOVE);
+        if (wbytes < 0 && errno == EINVAL) {
+            wbytes = read(req->tmp.pipefd[0], buffer, nbytes < BLOCK ? nbytes : BLOCK);
+            if (wbytes > 0 && write_bytes(req->tmp.fd, buffer, wbytes) != wbytes) {
+                return -1;
+            }
+        }
+
+        if (wbytes <= 0) {
+            return -1;
+        }
+
+        nbytes -= wbytes;
+    }
+
+    return 0;
+}
+
+// splices the body of an http request from the socket into the tmpfile
+// through the body pipe, so that body bytes never pass through user space.
+// the pipe is always drained before returning, so a suspended request
+// leaves nothing behind in it. falls back to recv_http_body's copy loop if
+// the socket cannot be spliced from
+//
+// connfd: socket file descriptor
+// req   : pointer to request struct
+//
+static int64_t splice_http_body(int connfd, request_t *req) {
+    ssize_t nbytes = 0;
+
+    do {
+        size_t len = req->fields.contlen < PIPE_CHUNK ? req->fields.contlen : PIPE_CHUNK;
+
+        nbytes = splice(connfd, NULL, req->tmp.pipefd[1], NULL, len,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        count_recv(nbytes);
+        if (nbytes < 0) {
+            switch (errno) {
+            case EWOULDBLOCK: req->status = SUSPEND; return nbytes;
+            case EINVAL:
+                close_body_pipe(req);
+                return recv_http_body(connfd, req);
+            default:
+                req->status = INT_ERR;
+                req->state = DONE;
+                return nbytes;
+            }
+        }
+
+        if (drain_body_pipe(req, nbytes) < 0) {
+            req->status = INT_ERR;
+            req->state = DONE;
+            return -1;
+        }
+
+        req->fields.contlen -= nbytes;
+    } while (req->fields.contlen > 0 && nbytes > 0);
+
+    req->status = OK;
+    req->state = WRITE_BODY;
+    return nbytes;
+}
+
+// value of a hexadecimal digit
+//
+static int64_t hex_value(uint8_t c) {
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+// decodes a piece of a chunked request body, writing the chunk data into
+// the tmpfile. the decoder keeps its state in the request, so the body can
+// be fed in pieces of any size as it arrives. chunk extensions and trailer
+// fields are skipped. returns the number of body bytes written, or -1 and
+// updates the status code if the framing is malformed or writing failed
+//
+// req: pointer to request struct
+// buf: received bytes
+// len: number of received bytes
+//
+static int64_t decode_chunked_body(request_t *req, uint8_t *buf, size_t len) {
+    chunk_t *chunk = &req->chunk;
+    int64_t written = 0;
+    size_t i = 0;
+
+    while (i < len && chunk->state != CHUNK_DONE) {
+        if (chunk->state == CHUNK_DATA) {
+            size_t n = len - i < (size_t) chunk->left ? len - i : (size_t) chunk->left;
+            if (write_bytes(req->tmp.fd, buf + i, n) != (ssize_t) n) {
+                req->status = INT_ERR;
+                return -1;
+            }
+
+            i += n;
+            written += n;
+            chunk->total += n;
+            chunk->left -= n;
+            chunk->state = chunk->left == 0 ? CHUNK_DATA_CR : CHUNK_DATA;
+            continue;
+        }
+
+        uint8_t c = buf[i++];
+
+        switch (chunk->state) {
+        case CHUNK_SIZE:
+            if (isxdigit(c) && chunk->left <= (INT64_MAX >> 4)) {
+                chunk->left = (chunk->left << 4) | hex_value(c);
+                chunk->digits = true;
+            } else if (chunk->digits && (c == ';' || c == ' ' || c == '\t')) {
+                chunk->state = CHUNK_EXT;
+            } else if (chunk->digits && c == '\r') {
+                chunk->state = CHUNK_SIZE_LF;
+            } else {
+                req->status = BAD_REQUEST;
+                return -1;
+            }
+            break;
+        case CHUNK_EXT: chunk->state = c == '\r' ? CHUNK_SIZE_LF : CHUNK_EXT; break;
+        case CHUNK_SIZE_LF:
+            if (c != '\n') {
+                req->status = BAD_REQUEST;
+                return -1;
+            }
+            chunk->state = chunk->left == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+            break;
+        case CHUNK_DATA_CR:
+            if (c != '\r') {
+                req->status = BAD_REQUEST;
+                return -1;
+            }
+            chunk->state = CHUNK_DATA_LF;
+            break;
+        case CHUNK_DATA_LF:
+            if (c != '\n') {
+                req->status = BAD_REQUEST;
+                return -1;
+            }
+            chunk->digits = false;
+            chunk->state = CHUNK_SIZE;
+            break;
+        case CHUNK_TRAILER: chunk->state = c == '\r' ? CHUNK_END_LF : CHUNK_TRAILER_LINE; break;
+        case CHUNK_TRAILER_LINE: chunk->state = c == '\n' ? CHUNK_TRAILER : chunk->state; break;
+        case CHUNK_END_LF:
+            if (c != '\n') {
+                req->status = BAD_REQUEST;
+                return -1;
+            }
+            chunk->state = CHUNK_DONE;
+            break;
+        default: break;
+        }
+    }
+
+    return written;
+}
+
+// recieves a chunked request body from a socket until its last chunk
+// has been decoded. a connection closed before that is a bad request,
+// since the body was cut short
+//
+// connfd: socket file descriptor
+// req   : pointer to request struct
+//
+static int64_t recv_chunked_body(int connfd, request_t *req) {
+    uint8_t buffer[BLOCK];
+    ssize_t nbytes = 0;
+
+    if (req->header.remout) {
+        req->header.remout = false;
+        if (decode_chunked_body(req, req->header.reqeo, req->header.rembytes) < 0) {
+            req->state = DONE;
+            return -1;
+        }
+    }
+
+    while (req->chunk.state != CHUNK_DONE) {
+        nbytes = recv(connfd, buffer, BLOCK, MSG_DONTWAIT);
+        count_recv(nbytes);
+        if (nbytes < 0) {
+            switch (errno) {
+            case EWOULDBLOCK: req->status = SUSPEND; return nbytes;
+            default: req->status = INT_ERR; break;
+            }
+        } else if (nbytes == 0) {
+            req->status = BAD_REQUEST;
+        }
+
+        if (nbytes <= 0 || decode_chunked_body(req, buffer, nbytes) < 0) {
+            req->state = DONE;
+            return -1;
+        }
+    }
+
+    req->status = OK;
+    req->state = WRITE_BODY;
+    return nbytes;
+}
+
 // recieves the body of an http request from a socket until it has
-// been received fully, or the client closes connection. updates
-// status code if internal server error is encountered
+// been received fully, or the client closes connection. the body is
+// spliced through the body pipe when there is one, and copied through
+// a buffer otherwise. updates status code if internal server error is
+// encountered
 //
 // connfd: socket file descriptor
 // h     : pointer to header struct
@@ -120,8 +424,17 @@ int64_t recv_http_body(int connfd, request_t *req) {
     uint8_t buffer[BLOCK] = { 0 };
     ssize_t nbytes = 0;
 
+    if (req->fields.chunked) {
+        return recv_chunked_body(connfd, req);
+    }
+
+    if (req->tmp.pipefd[0] >= 0) {
+        return splice_http_body(connfd, req);
+    }
+
     do {
         nbytes = recv(connfd, buffer, BLOCK, MSG_DONTWAIT);
+        count_recv(nbytes);
         if (nbytes < 0) {
             switch (errno) {
             case EWOULDBLOCK: req->status = SUSPEND; return nbytes;
@@ -142,29 +455,83 @@ int64_t recv_http_body(int connfd, request_t *req) {
     return nbytes;
 }
 
-// sends the body (contents) for an http request to the client
-// socket until it has been fully recieved, or the client closes
-// the connection. updates status code in internal server error
-// or bad request errors are encountered
+// asks the kernel to send from user pages without copying them, and
+// returns true if zerocopy sends can be used on the socket
 //
 // connfd: socket file descriptor
-// fd    : requested file's file descriptor
-// status: status code tracking request status
 //
-int64_t send_http_body(int connfd, request_t *req) {
-    uint8_t buffer[BLOCK] = { 0 };
-    ssize_t nbytes = 0, sbytes = 0;
+bool enable_zerocopy(int connfd) {
+#ifdef SO_ZEROCOPY
+    int one = 1;
+    return setsockopt(connfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one) == 0;
+#else
+    (void) connfd;
+    return false;
+#endif
+}
+
+// drains zerocopy completion notifications from the socket error queue.
+// pending notifications make the socket report EPOLLERR, so they must be
+// consumed before the connection is suspended on the poller
+//
+// connfd: socket file descriptor
+//
+static void reap_zerocopy(int connfd) {
+    uint8_t control[128];
+    struct msghdr msg;
 
-    // take precaution to set contlen to 0 before calling this function
     do {
-        nbytes = read_bytes(req->object.fd, buffer, BLOCK);
-        sbytes = send(connfd, buffer, nbytes, MSG_DONTWAIT);
+        memset(&msg, 0, sizeof msg);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+    } while (recvmsg(connfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0);
+}
+
+// sends the body of an http response straight out of a shared mapping of
+// the requested object, from object.offset up to object.end. the offset is
+// advanced as bytes are sent so the transfer can be resumed after a
+// suspension
+//
+// connfd: socket file descriptor
+// req   : pointer to request struct
+//
+static int64_t send_mapped_body(int connfd, request_t *req) {
+    mapping_t *map = req->object.map;
+    ssize_t sbytes = 0;
+
+    if (req->object.zerocopy) {
+        reap_zerocopy(connfd);
+    }
+
+    while (req->object.offset < req->object.end) {
+        size_t len = req->object.end - req->object.offset;
+        int flags = MSG_DONTWAIT;
+
+#ifdef MSG_ZEROCOPY
+        if (req->object.zerocopy && len >= ZEROCOPY_MIN) {
+            flags |= MSG_ZEROCOPY;
+        }
+#endif
+
+        sbytes = send(connfd, map->addr + req->object.offset, len, flags);
+        count_send(sbytes);
         if (sbytes < 0) {
             switch (errno) {
             case EWOULDBLOCK:
-                lseek(req->object.fd, req->fields.contlen, SEEK_SET);
+                if (req->object.zerocopy) {
+                    reap_zerocopy(connfd);
+                }
                 req->status = SUSPEND;
                 return sbytes;
+            case ENOBUFS:
+                // out of optmem for pinned pages, fall back to copying
+                if (req->object.zerocopy) {
+                    req->object.zerocopy = false;
+                    continue;
+                }
+                req->status = INT_ERR;
+                req->state = DONE;
+                return sbytes;
             case EPIPE:
                 req->status = CONN_CLOSED;
                 req->state = DONE;
@@ -180,12 +547,95 @@ int64_t send_http_body(int connfd, request_t *req) {
             }
         }
 
-        req->fields.contlen += nbytes;
-    } while (nbytes > 0 && sbytes > 0);
+        req->object.offset += sbytes;
+    }
+
+    req->status = OK;
+    req->state = DONE;
+    return req->object.offset;
+}
+
+// sends the body (contents) for an http request to the client
+// socket until it has been fully recieved, or the client closes
+// the connection. the part of the object from object.offset up to
+// object.end is sent with sendfile(), which advances the offset so
+// the transfer can be resumed after a suspension. the socket must
+// be non-blocking. updates status code in internal server error
+// or bad request errors are encountered
+//
+// connfd: socket file descriptor
+// req   : pointer to request struct
+//
+int64_t send_http_body(int connfd, request_t *req) {
+    ssize_t sbytes = 0;
+
+    if (req->object.map != NULL) {
+        return send_mapped_body(connfd, req);
+    }
+
+    while (req->object.offset < req->object.end) {
+        // the object starts at base within its descriptor
+        off_t pos = req->object.base + req->object.offset;
+
+        sbytes = sendfile(connfd, req->object.fd, &pos, req->object.end - req->object.offset);
+        count_send(sbytes);
+        if (sbytes > 0) {
+            req->object.offset += sbytes;
+        }
+
+        if (sbytes < 0) {
+            switch (errno) {
+            case EWOULDBLOCK: req->status = SUSPEND; return sbytes;
+            case EPIPE:
+                req->status = CONN_CLOSED;
+                req->state = DONE;
+                return sbytes;
+            case ECONNRESET:
+                req->status = CONN_CLOSED;
+                req->state = DONE;
+                return sbytes;
+            default:
+                req->status = INT_ERR;
+                req->state = DONE;
+                return sbytes;
+            }
+        }
+
+        // the file was truncated under us, nothing more can be sent
+        if (sbytes == 0) {
+            break;
+        }
+    }
 
     req->status = OK;
     req->state = DONE;
-    return req->fields.contlen;
+    return req->object.offset;
+}
+
+// formats the strong entity tag of the requested object from its
+// inode number, size and modification time. a PUT always commits a
+// new inode and an APPEND changes the size and modification time, so
+// the tag changes whenever the contents do
+//
+// req : pointer to request struct
+// etag: buffer of at least ETAG_SIZE bytes
+//
+static void format_etag(request_t *req, char *etag) {
+    snprintf(etag, ETAG_SIZE, "\"%" PRIx64 "-%zx-%" PRIx64 "\"", (uint64_t) req->object.ino,
+        req->object.size,
+        (uint64_t) req->object.mtime.tv_sec * 1000000000 + req->object.mtime.tv_nsec);
+}
+
+// formats a timestamp as an http date (IMF-fixdate)
+//
+// secs: seconds since the epoch
+// date: buffer of at least DATE_SIZE bytes
+//
+static void format_http_date(time_t secs, char *date) {
+    struct tm tm;
+
+    gmtime_r(&secs, &tm);
+    strftime(date, DATE_SIZE, HTTP_DATE_FMT, &tm);
 }
 
 // sends an http response to the client socket. If the send fails,
@@ -199,16 +649,41 @@ int64_t send_http_body(int connfd, request_t *req) {
 ssize_t send_http_response(int connfd, request_t *req, status_t status) {
     char buffer[BLOCK] = { 0 };
     ssize_t nbytes = 0;
+    size_t len;
     char *msg;
 
-    if (status == OK && req->reqline.method == GET) {
-        sprintf(buffer, GET_OK_MSG, req->fields.contlen);
+    if ((req->reqline.method == GET || req->reqline.method == HEAD)
+        && (status == OK || status == PARTIAL || status == NOT_MODIFIED)) {
+        char etag[ETAG_SIZE], date[DATE_SIZE];
+
+        format_etag(req, etag);
+        format_http_date(req->object.mtime.tv_sec, date);
+        if (status == OK) {
+            sprintf(buffer, GET_OK_MSG, req->fields.contlen, etag, date);
+        } else if (status == PARTIAL) {
+            sprintf(buffer, PARTIAL_MSG, (int64_t) req->object.offset,
+                (int64_t) req->object.end - 1, (int64_t) req->object.size, req->fields.contlen,
+                etag, date);
+        } else {
+            sprintf(buffer, NOT_MODIFIED_MSG, etag, date);
+        }
+
+        msg = buffer;
+    } else if (status == BAD_RANGE) {
+        sprintf(buffer, BAD_RANGE_MSG, (int64_t) req->object.size);
         msg = buffer;
     } else {
         msg = resolve_status_msg(status);
     }
 
-    nbytes = send(connfd, msg, strlen(msg), 0);
+    // responses to HEAD carry the header fields of the response but no body
+    len = strlen(msg);
+    if (req->reqline.method == HEAD) {
+        len = strstr(msg, "\r\n\r\n") + 4 - msg;
+    }
+
+    nbytes = send(connfd, msg, len, 0);
+    count_send(nbytes);
     if (nbytes < 0) {
         switch (errno) {
         case EPIPE:
@@ -229,6 +704,186 @@ ssize_t send_http_response(int connfd, request_t *req, status_t status) {
     return nbytes;
 }
 
+// tells a client that sent "Expect: 100-continue" to go ahead with its
+// body, once the request has passed the checks that could reject it.
+// nothing is sent if the client did not ask, if the body is empty, or if
+// the client already started sending it without waiting. returns the
+// number of bytes sent, or < 0 if there was an error
+//
+// connfd: socket file descriptor
+// req   : pointer to request struct
+//
+ssize_t send_http_continue(int connfd, request_t *req) {
+    if (req->fields.expect == false || req->header.rembytes > 0 || req->fields.contlen == 0) {
+        return 0;
+    }
+
+    req->fields.expect = false;
+    return send_http_response(connfd, req, CONTINUE);
+}
+
+// checks if a header field line matched by the field regex has the given
+// field name. field names are case-insensitive
+//
+// fieldptr: start of the header field line
+// match   : regex matches for the field line
+// name    : field name to compare against
+//
+static bool field_is(uint8_t *fieldptr, regmatch_t *match, char *name) {
+    size_t name_len = match[1].rm_eo - match[1].rm_so;
+    return name_len == strlen(name)
+           && strncasecmp((char *) fieldptr + match[1].rm_so, name, name_len) == 0;
+}
+
+// parses the value of a Range header field. only single byte ranges of the
+// forms "bytes=first-last", "bytes=first-" and "bytes=-suffix" are
+// understood, anything else leaves the range unset so that the whole
+// object is sent as if no range was requested
+//
+// value: range field value, modified in place
+// range: pointer to range struct
+//
+static void parse_range(char *value, range_t *range) {
+    char *dash;
+
+    if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL) {
+        return;
+    }
+
+    value += 6;
+    dash = strchr(value, '-');
+    if (dash == NULL) {
+        return;
+    }
+
+    *dash++ = '\0';
+    if (*value == '\0') {
+        // suffix range, last holds the number of trailing bytes
+        if (*dash == '\0' || (range->last = strtoint64u(dash)) < 0) {
+            return;
+        }
+
+        range->first = -1;
+    } else {
+        if ((range->first = strtoint64u(value)) < 0) {
+            return;
+        }
+
+        if (*dash == '\0') {
+            range->last = -1;
+        } else if ((range->last = strtoint64u(dash)) < range->first) {
+            return;
+        }
+    }
+
+    range->set = true;
+}
+
+// parses an http date (IMF-fixdate) and returns it in seconds since the
+// epoch, or -1 if the date is malformed
+//
+// date: date string
+//
+static time_t parse_http_date(char *date) {
+    struct tm tm = { 0 };
+    char *end = strptime(date, HTTP_DATE_FMT, &tm);
+
+    if (end == NULL || *end != '\0') {
+        return -1;
+    }
+
+    return timegm(&tm);
+}
+
+// checks if the entity tag of the requested object is in a list of entity
+// tags from an If-None-Match field. If-None-Match uses weak comparison, so
+// W/ prefixes are ignored
+//
+// req  : pointer to request struct
+// etags: comma separated list of entity tags, or "*"
+//
+static bool etag_matches(request_t *req, char *etags) {
+    char etag[ETAG_SIZE];
+    size_t etag_len;
+
+    format_etag(req, etag);
+    etag_len = strlen(etag);
+
+    while (*etags != '\0') {
+        etags += strspn(etags, " \t,");
+        if (*etags == '*') {
+            return true;
+        }
+
+        if (strncmp(etags, "W/", 2) == 0) {
+            etags += 2;
+        }
+
+        if (strncmp(etags, etag, etag_len) == 0 && strchr(" \t,", etags[etag_len]) != NULL) {
+            return true;
+        }
+
+        etags += strcspn(etags, ",");
+    }
+
+    return false;
+}
+
+// evaluates If-None-Match and If-Modified-Since against the validators of
+// the requested object and sets object.status to NOT_MODIFIED if the
+// client's copy is still current. If-Modified-Since is ignored when
+// If-None-Match is present
+//
+// req: pointer to request struct
+//
+void evaluate_http_conditions(request_t *req) {
+    req->object.status = OK;
+
+    if (req->fields.etags != NULL) {
+        if (etag_matches(req, req->fields.etags)) {
+            req->object.status = NOT_MODIFIED;
+        }
+    } else if (req->fields.since >= 0 && req->object.mtime.tv_sec <= req->fields.since) {
+        req->object.status = NOT_MODIFIED;
+    }
+}
+
+// resolves the requested range against the size of the object and sets the
+// part of the object to be sent and the content length of the response.
+// object.status is set to PARTIAL if a range is sent, and the request status
+// to BAD_RANGE if the range cannot be satisfied
+//
+// req: pointer to request struct
+//
+void resolve_http_range(request_t *req) {
+    range_t *range = &req->fields.range;
+    int64_t size = req->object.size;
+
+    req->object.offset = 0;
+    req->object.end = size;
+    req->object.status = OK;
+
+    if (range->set == true) {
+        if (size == 0 || range->first >= size || (range->first < 0 && range->last == 0)) {
+            req->status = BAD_RANGE;
+            return;
+        }
+
+        if (range->first < 0) {
+            req->object.offset = range->last < size ? size - range->last : 0;
+        } else {
+            req->object.offset = range->first;
+            if (range->last >= 0 && range->last < size) {
+                req->object.end = range->last + 1;
+            }
+        }
+
+        req->object.status = PARTIAL;
+    }
+
+    req->fields.contlen = req->object.end - req->object.offset;
+}
+
 // parses an http header and populates a header struct with the fields
 // of the request
 //
@@ -264,6 +919,8 @@ void parse_http_request(request_t *req) {
         req->reqline.method = PUT;
     } else if (strcmp(method, "APPEND") == 0 || strcmp(method, "append") == 0) {
         req->reqline.method = APPEND;
+    } else if (strcmp(method, "HEAD") == 0 || strcmp(method, "head") == 0) {
+        req->reqline.method = HEAD;
     } else {
         req->status = NOT_IMPL;
         req->state = DONE;
@@ -277,7 +934,7 @@ void parse_http_request(request_t *req) {
     // check the object of the request -------------------------------------------------------------
     size_t object_len = match[2].rm_eo - match[2].rm_so;
 
-    if (object_len > 19) {
+    if (object_len > max_object_len) {
         req->status = BAD_REQUEST;
         req->state = DONE;
         free_header_re(&h_reg);
@@ -292,7 +949,7 @@ void parse_http_request(request_t *req) {
 
     // check for end of request, no header fields --------------------------------------------------
     if (match[4].rm_so > 0) {
-        if (req->reqline.method != GET) {
+        if (req->reqline.method != GET && req->reqline.method != HEAD) {
             req->status = BAD_REQUEST;
             req->state = DONE;
         } else {
@@ -315,24 +972,79 @@ void parse_http_request(request_t *req) {
             return;
         }
 
-        if (strncmp((char *) fieldptr, "Content-Length", 14) == 0) {
+        if (field_is(fieldptr, match, "Content-Length")) {
             size_t len_len = match[2].rm_eo - match[2].rm_so;
             char *num = strndup((char *) fieldptr + match[2].rm_so, len_len);
             req->fields.contlen = strtoint64u(num);
             free(num);
         }
 
-        if (strncmp((char *) fieldptr, "Request-Id", 10) == 0) {
+        if (field_is(fieldptr, match, "Transfer-Encoding")
+            && (req->reqline.method == PUT || req->reqline.method == APPEND)) {
+            size_t coding_len = match[2].rm_eo - match[2].rm_so;
+            if (coding_len != 7 || strncasecmp((char *) fieldptr + match[2].rm_so, "chunked", 7)) {
+                req->status = NOT_IMPL;
+                req->state = DONE;
+                free_header_re(&h_reg);
+                return;
+            }
+
+            req->fields.chunked = true;
+        }
+
+        if (field_is(fieldptr, match, "Expect")
+            && (req->reqline.method == PUT || req->reqline.method == APPEND)) {
+            size_t expect_len = match[2].rm_eo - match[2].rm_so;
+            if (expect_len != 12
+                || strncasecmp((char *) fieldptr + match[2].rm_so, "100-continue", 12)) {
+                req->status = EXPECT_FAILED;
+                req->state = DONE;
+                free_header_re(&h_reg);
+                return;
+            }
+
+            req->fields.expect = true;
+        }
+
+        if (field_is(fieldptr, match, "Request-Id")) {
             size_t id_len = match[2].rm_eo - match[2].rm_so;
             char *num = strndup((char *) fieldptr + match[2].rm_so, id_len);
             req->fields.reqid = strtouint32(num);
             free(num);
         }
 
+        if (field_is(fieldptr, match, "If-None-Match")
+            && (req->reqline.method == GET || req->reqline.method == HEAD)) {
+            size_t etags_len = match[2].rm_eo - match[2].rm_so;
+            free(req->fields.etags);
+            req->fields.etags = strndup((char *) fieldptr + match[2].rm_so, etags_len);
+        }
+
+        if (field_is(fieldptr, match, "If-Modified-Since")
+            && (req->reqline.method == GET || req->reqline.method == HEAD)) {
+            size_t date_len = match[2].rm_eo - match[2].rm_so;
+            char *date = strndup((char *) fieldptr + match[2].rm_so, date_len);
+            req->fields.since = parse_http_date(date);
+            free(date);
+        }
+
+        if (field_is(fieldptr, match, "Range") && req->reqline.method == GET) {
+            size_t range_len = match[2].rm_eo - match[2].rm_so;
+            char *range = strndup((char *) fieldptr + match[2].rm_so, range_len);
+            parse_range(range, &req->fields.range);
+            free(range);
+        }
+
         fieldptr += match[0].rm_eo;
     } while (match[3].rm_so < 0);
 
-    if (req->fields.contlen < 0 && req->reqline.method != GET) {
+    // a chunked body carries its own framing, any Content-Length is ignored
+    if (req->fields.chunked) {
+        req->fields.contlen = -1;
+    }
+
+    if (req->fields.contlen < 0 && req->fields.chunked == false && req->reqline.method != GET
+        && req->reqline.method != HEAD) {
         req->status = BAD_REQUEST;
         req->state = DONE;
         free_header_re(&h_reg);
@@ -349,8 +1061,10 @@ void parse_http_request(request_t *req) {
     // check end of request for extra body bytes ---------------------------------------------------
     req->header.reqeo = req->header.buf + match[0].rm_eo;
     req->header.rembytes = req->header.size - match[0].rm_eo;
-    req->header.rembytes
-        = req->fields.contlen < req->header.rembytes ? req->fields.contlen : req->header.rembytes;
+    if (req->fields.chunked == false) {
+        req->header.rembytes = req->fields.contlen < req->header.rembytes ? req->fields.contlen
+                                                                          : req->header.rembytes;
+    }
     req->header.remout = req->header.rembytes > 0 ? true : false;
 
     req->status = OK;
@@ -1,16 +1,22 @@
 #ifndef __REQUEST_H__
 #define __REQUEST_H__
 
+#include "appender.h"
+#include "mmapcache.h"
 #include "re.h"
 #include "status.h"
+#include "util.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
 
 #define REQSIZE 2048
 #define TMPSIZE 14
 
-typedef enum { NONE, GET, PUT, APPEND } method_t;
+#define DEFAULT_OBJECT_LEN 19
+
+typedef enum { NONE, GET, PUT, APPEND, HEAD } method_t;
 
 typedef enum {
     RECV_HEADER,
@@ -22,6 +28,7 @@ typedef enum {
     RECV_REM_BODY,
     RECV_BODY,
     WRITE_BODY,
+    SYNC_BODY,
     DONE
 } state_t;
 
@@ -31,9 +38,39 @@ typedef struct {
     char *version;
 } reqline_t;
 
+typedef struct {
+    bool set;
+    int64_t first, last;
+} range_t;
+
+typedef enum {
+    CHUNK_SIZE,
+    CHUNK_EXT,
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER,
+    CHUNK_TRAILER_LINE,
+    CHUNK_END_LF,
+    CHUNK_DONE
+} chunkstate_t;
+
+typedef struct {
+    chunkstate_t state;
+    int64_t left;
+    int64_t total;
+    bool digits;
+} chunk_t;
+
 typedef struct {
     uint32_t reqid;
     int64_t contlen;
+    bool chunked;
+    bool expect;
+    range_t range;
+    char *etags;
+    time_t since;
 } fields_t;
 
 typedef struct {
@@ -47,22 +84,57 @@ typedef struct {
 typedef struct {
     int fd;
     size_t size;
+    off_t base;
+    off_t offset, end;
+    ino_t ino;
+    struct timespec mtime;
     status_t status;
+    mapping_t *map;
+    bool zerocopy;
 } object_t;
 
 typedef struct {
     int fd;
+    int pipefd[2];
     char name[TMPSIZE];
+    appendslot_t *slot;
+    int32_t segment;
+    off_t record;
 } temp_t;
 
+// a commit that has to be durable before it is acknowledged
+//
+typedef struct {
+    int fd;                 // descriptor the commit is synced through
+    char dir[SHARD_PREFIX]; // directory whose entries the commit changed, "" if none
+    bool synced;            // set once the syncer is done with the commit
+    bool failed;            // set if the commit could not be synced
+} durable_t;
+
+// where the time of a request goes, kept when the server keeps metrics.
+// times are monotonic nanoseconds
+//
+typedef struct {
+    uint64_t queued;    // when the request was last queued for a worker
+    uint64_t suspended; // when the request last suspended, 0 if it has not
+    uint64_t mark;      // when the request entered the state it is timed in
+    state_t state;      // state the request was last seen in
+    status_t result;    // status the request was logged with
+    uint32_t suspends;  // times the request suspended
+} timing_t;
+
 typedef struct {
     header_t header;
     reqline_t reqline;
     fields_t fields;
     object_t object;
     temp_t tmp;
+    chunk_t chunk;
+    durable_t durable;
     status_t status;
     state_t state;
+    struct timespec start;
+    timing_t timing;
 } request_t;
 
 request_t request_create(void);
@@ -71,14 +143,24 @@ void request_destroy(request_t *req);
 
 void recv_http_request(int connfd, request_t *req);
 
-int64_t recv_rem_http_body(request_t *req);
+int64_t recv_rem_http_body(int connfd, request_t *req);
 
 int64_t recv_http_body(int connfd, request_t *req);
 
+bool enable_zerocopy(int connfd);
+
 int64_t send_http_body(int connfd, request_t *req);
 
 ssize_t send_http_response(int connfd, request_t *req, status_t status);
 
+ssize_t send_http_continue(int connfd, request_t *req);
+
+void set_object_limit(size_t maxlen);
+
 void parse_http_request(request_t *req);
 
+void resolve_http_range(request_t *req);
+
+void evaluate_http_conditions(request_t *req);
+
 #endif
@@ -0,0 +1,184 @@
+#include "stats.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// counting is a load and a store to a counter only the calling thread
+// writes, with no atomic read-modify-write. threads that have not
+// attached, and every thread when the server keeps no stats, count nothing
+
+struct stats_t {
+    char name[STATS_NAMELEN];
+    statseg_t *seg;
+    size_t size;
+};
+
+// the block of counters of the calling thread
+static _Thread_local statblock_t *local_block;
+
+static uint64_t clock_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// writes the name of the stats segment of the server on a port
+//
+// port: port of the server
+// name: buffer of STATS_NAMELEN bytes
+//
+void stats_name(uint16_t port, char *name) {
+    snprintf(name, STATS_NAMELEN, "/httpserver.%u", port);
+}
+
+// creates the stats segment, replacing one a previous server left behind
+//
+// name    : name of the shared memory segment
+// nthreads: number of threads that can attach
+//
+stats_t *stats_create(char *name, uint32_t nthreads) {
+    stats_t *stats = (stats_t *) malloc(sizeof(stats_t));
+    int fd;
+
+    if (stats == NULL) {
+        return NULL;
+    }
+
+    snprintf(stats->name, STATS_NAMELEN, "%s", name);
+    stats->size = sizeof(statseg_t) + nthreads * sizeof(statblock_t);
+
+    fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        free(stats);
+        return NULL;
+    }
+
+    // truncating first zeroes whatever an earlier segment held
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, stats->size) < 0) {
+        close(fd);
+        shm_unlink(name);
+        free(stats);
+        return NULL;
+    }
+
+    stats->seg = (statseg_t *) mmap(NULL, stats->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats->seg == MAP_FAILED) {
+        shm_unlink(name);
+        free(stats);
+        return NULL;
+    }
+
+    stats->seg->version = STATS_VERSION;
+    stats->seg->nstats = NSTATS;
+    stats->seg->nblocks = nthreads;
+    stats->seg->pid = getpid();
+    atomic_init(&stats->seg->attached, 0);
+    atomic_init(&stats->seg->queued, 0);
+
+    // readers check the magic last
+    atomic_thread_fence(memory_order_release);
+    stats->seg->magic = STATS_MAGIC;
+    return stats;
+}
+
+// unmaps and removes the stats segment. every thread that attached must
+// have stopped counting
+//
+void stats_destroy(stats_t **stats) {
+    if (stats && *stats) {
+        munmap((*stats)->seg, (*stats)->size);
+        shm_unlink((*stats)->name);
+        free(*stats);
+        *stats = NULL;
+    }
+}
+
+// gives the calling thread a block of counters of its own. a thread that
+// finds every block taken counts nothing
+//
+void stats_attach(stats_t *stats) {
+    uint32_t i = atomic_fetch_add(&stats->seg->attached, 1);
+
+    if (i < stats->seg->nblocks) {
+        local_block = &stats->seg->blocks[i];
+    }
+}
+
+// adds to a counter of the calling thread
+//
+// stat: counter
+// n   : amount to add
+//
+void stats_count(stat_t stat, uint64_t n) {
+    _Atomic uint64_t *counter;
+
+    if (local_block == NULL) {
+        return;
+    }
+
+    counter = &local_block->counts[stat];
+    atomic_store_explicit(
+        counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// changes the number of connections in the work queue
+//
+void stats_queued(stats_t *stats, int64_t delta) {
+    atomic_fetch_add_explicit(&stats->seg->queued, delta, memory_order_relaxed);
+}
+
+static void count_wait(stat_t waits, uint64_t start) {
+    stats_count(waits, 1);
+    stats_count(waits + 1, clock_ns() - start);
+}
+
+// locks a mutex. a contended lock is counted as a wait, with the time
+// spent waiting for it
+//
+// lock : mutex
+// waits: wait counter of the lock
+//
+void stats_lock_mutex(pthread_mutex_t *lock, stat_t waits) {
+    uint64_t start;
+
+    if (local_block == NULL) {
+        pthread_mutex_lock(lock);
+        return;
+    }
+
+    if (pthread_mutex_trylock(lock) == 0) {
+        return;
+    }
+
+    start = clock_ns();
+    pthread_mutex_lock(lock);
+    count_wait(waits, start);
+}
+
+// locks a reader-writer lock like stats_lock_mutex()
+//
+// lock     : reader-writer lock
+// exclusive: whether to lock for writing
+// waits    : wait counter of the lock
+//
+void stats_lock_rwlock(pthread_rwlock_t *lock, bool exclusive, stat_t waits) {
+    uint64_t start;
+
+    if (local_block == NULL) {
+        exclusive ? pthread_rwlock_wrlock(lock) : pthread_rwlock_rdlock(lock);
+        return;
+    }
+
+    if ((exclusive ? pthread_rwlock_trywrlock(lock) : pthread_rwlock_tryrdlock(lock)) == 0) {
+        return;
+    }
+
+    start = clock_ns();
+    exclusive ? pthread_rwlock_wrlock(lock) : pthread_rwlock_rdlock(lock);
+    count_wait(waits, start);
+}
@@ -0,0 +1,73 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// the runtime counters of the server, kept in a shared memory segment
+// that tools/statsread maps to read them. every thread that counts owns a
+// block of counters in the segment and is the only one to write it. the
+// layout of the segment is the one below, STATS_VERSION changes with it
+
+#define STATS_MAGIC   0x54535348
+#define STATS_VERSION 1
+#define STATS_NAMELEN 32
+
+// a wait counter is always followed by the nanoseconds spent waiting
+typedef enum {
+    STAT_ACCEPTS,       // connections accepted
+    STAT_WAKEUPS,       // epoll_wait returns
+    STAT_EVENTS,        // events returned by epoll_wait
+    STAT_REQUESTS,      // requests finished
+    STAT_SUSPENDS,      // times requests suspended
+    STAT_RESUMES,       // times suspended requests were taken up again
+    STAT_RECVS,         // socket receives, recv or splice
+    STAT_BYTES_IN,      // bytes received
+    STAT_SENDS,         // socket sends, send or sendfile
+    STAT_BYTES_OUT,     // bytes sent
+    STAT_DEQUEUES,      // connections taken off the work queue
+    STAT_QUEUE_NS,      // time connections waited in the work queue
+    STAT_LOCK_WAITS,    // contended object lock acquisitions
+    STAT_LOCK_NS,       // time spent waiting for them
+    STAT_MAPLOCK_WAITS, // contended connection map lock acquisitions
+    STAT_MAPLOCK_NS,    // time spent waiting for them
+    STAT_TMPFILES,      // tmpfiles created
+    NSTATS
+} stat_t;
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t counts[NSTATS];
+} statblock_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nstats;
+    uint32_t nblocks;
+    int32_t pid;
+    _Atomic uint32_t attached;
+    _Atomic int64_t queued;
+    statblock_t blocks[];
+} statseg_t;
+
+typedef struct stats_t stats_t;
+
+void stats_name(uint16_t port, char *name);
+
+stats_t *stats_create(char *name, uint32_t nthreads);
+
+void stats_destroy(stats_t **stats);
+
+void stats_attach(stats_t *stats);
+
+void stats_count(stat_t stat, uint64_t n);
+
+void stats_queued(stats_t *stats, int64_t delta);
+
+void stats_lock_mutex(pthread_mutex_t *lock, stat_t waits);
+
+void stats_lock_rwlock(pthread_rwlock_t *lock, bool exclusive, stat_t waits);
+
+#endif
@@ -3,7 +3,13 @@
 
 #include <inttypes.h>
 
-#define GET_OK_MSG    "HTTP/1.1 200 OK\r\nContent-Length: %" PRId64 "\r\n\r\n"
+#define GET_OK_MSG                                                                                 \
+    "HTTP/1.1 200 OK\r\nContent-Length: %" PRId64 "\r\nETag: %s\r\nLast-Modified: %s\r\n\r\n"
+#define PARTIAL_MSG                                                                                \
+    "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %" PRId64 "-%" PRId64 "/%" PRId64     \
+    "\r\nContent-Length: %" PRId64 "\r\nETag: %s\r\nLast-Modified: %s\r\n\r\n"
+#define CONTINUE_MSG     "HTTP/1.1 100 Continue\r\n\r\n"
+#define NOT_MODIFIED_MSG "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nLast-Modified: %s\r\n\r\n"
 #define OK_MSG        "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nOK\n"
 #define CREATED_MSG   "HTTP/1.1 201 Created\r\nContent-Length: 8\r\n\r\nCreated\n"
 #define FORBIDDEN_MSG "HTTP/1.1 403 Forbidden\r\nContent-Length: 10\r\n\r\nForbidden\n"
@@ -11,33 +17,50 @@
 #define BAD_REQ_MSG   "HTTP/1.1 400 Bad Request\r\nContent-Length: 12\r\n\r\nBad Request\n"
 #define INTERNAL_MSG                                                                               \
     "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 22\r\n\r\nInternal Server Error\n"
+#define BAD_RANGE_MSG                                                                              \
+    "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%" PRId64                       \
+    "\r\nContent-Length: 22\r\n\r\nRange Not Satisfiable\n"
+#define EXPECT_FAILED_MSG                                                                          \
+    "HTTP/1.1 417 Expectation Failed\r\nContent-Length: 19\r\n\r\nExpectation Failed\n"
 #define NOT_IMPL_MSG "HTTP/1.1 501 Not Implemented\r\nContent-Length: 16\r\n\r\nNot Implemented\n"
+#define NO_SPACE_MSG                                                                               \
+    "HTTP/1.1 507 Insufficient Storage\r\nContent-Length: 21\r\n\r\nInsufficient Storage\n"
 
 #define GET_LOG_MSG    "GET,/%s,%d,%" PRIu32 "\n"
 #define PUT_LOG_MSG    "PUT,/%s,%d,%" PRIu32 "\n"
 #define APPEND_LOG_MSG "APPEND,/%s,%d,%" PRIu32 "\n"
+#define HEAD_LOG_MSG   "HEAD,/%s,%d,%" PRIu32 "\n"
 
 typedef enum {
     CONN_CLOSED = -1,
     SUSPEND = 0,
+    CONTINUE = 100,
     OK = 200,
     CREATED = 201,
+    PARTIAL = 206,
+    NOT_MODIFIED = 304,
     BAD_REQUEST = 400,
     FORBIDDEN = 403,
     FILE_NOT_FOUND = 404,
+    BAD_RANGE = 416,
+    EXPECT_FAILED = 417,
     INT_ERR = 500,
-    NOT_IMPL = 501
+    NOT_IMPL = 501,
+    NO_SPACE = 507
 } status_t;
 
 static inline char *resolve_status_msg(status_t status) {
     switch (status) {
+    case CONTINUE: return CONTINUE_MSG;
     case OK: return OK_MSG;
     case CREATED: return CREATED_MSG;
     case BAD_REQUEST: return BAD_REQ_MSG;
     case FORBIDDEN: return FORBIDDEN_MSG;
     case FILE_NOT_FOUND: return NOT_FOUND_MSG;
     case INT_ERR: return INTERNAL_MSG;
+    case EXPECT_FAILED: return EXPECT_FAILED_MSG;
     case NOT_IMPL: return NOT_IMPL_MSG;
+    case NO_SPACE: return NO_SPACE_MSG;
     default: return BAD_REQ_MSG;
     }
 }
@@ -0,0 +1,88 @@
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include "request.h"
+#include "status.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// a storage backend, the layer between the request handlers and wherever
+// the objects live. backends embed a store_t as their first member and
+// implement these operations, which the handlers call with the object's
+// lock held (shared for open/stat/check, exclusive for commit/refresh/openw)
+//
+// open   : opens an object for reading. returns a descriptor owned by the
+//          caller, fills in the object's metadata (st_size, st_ino as its
+//          version, st_mtim) and the offset of its first byte in the
+//          descriptor. returns -1 and updates the status code on failure
+// stat   : fills in an object's metadata without opening it
+// check  : checks that the object of a PUT or APPEND can be written, and
+//          guesses the PUT's final status (CREATED or OK)
+// stage  : sets up req->tmp so that the body can be received into tmp.fd
+// commit : makes a received body visible, as the new version of the object
+//          for a PUT and at its end for an APPEND. a PUT learns its final
+//          status in req->object.status. leaves a descriptor the write can
+//          be made durable through in req->object.fd, and returns 1 if a
+//          directory entry changed as well, naming the directory in
+//          req->durable.dir, 0 if not, and -1 on failure
+// refresh: picks up a change made to an object outside of commit (an
+//          in-place APPEND publishing its bytes). returns 0 or -1
+// openw  : opens an object for reading and writing in place (an in-place
+//          APPEND). returns a descriptor, or -1 and updates the status code
+//
+// check, stage and commit return -1 and update req->status on failure
+//
+typedef struct store_t store_t;
+
+typedef struct {
+    int (*open)(store_t *store, char *name, struct stat *statbuf, off_t *base, status_t *status);
+    int (*stat)(store_t *store, char *name, struct stat *statbuf, status_t *status);
+    int (*check)(store_t *store, request_t *req);
+    int (*stage)(store_t *store, request_t *req);
+    int (*commit)(store_t *store, request_t *req);
+    int (*refresh)(store_t *store, char *name);
+    int (*openw)(store_t *store, char *name, status_t *status);
+    void (*destroy)(store_t *store);
+} storeops_t;
+
+struct store_t {
+    const storeops_t *ops;
+};
+
+static inline int store_open(
+    store_t *store, char *name, struct stat *statbuf, off_t *base, status_t *status) {
+    return store->ops->open(store, name, statbuf, base, status);
+}
+
+static inline int store_stat(store_t *store, char *name, struct stat *statbuf, status_t *status) {
+    return store->ops->stat(store, name, statbuf, status);
+}
+
+static inline int store_check(store_t *store, request_t *req) {
+    return store->ops->check(store, req);
+}
+
+static inline int store_stage(store_t *store, request_t *req) {
+    return store->ops->stage(store, req);
+}
+
+static inline int store_commit(store_t *store, request_t *req) {
+    return store->ops->commit(store, req);
+}
+
+static inline int store_refresh(store_t *store, char *name) {
+    return store->ops->refresh(store, name);
+}
+
+static inline int store_openw(store_t *store, char *name, status_t *status) {
+    return store->ops->openw(store, name, status);
+}
+
+static inline void store_destroy(store_t **store) {
+    if (store && *store) {
+        (*store)->ops->destroy(*store);
+        *store = NULL;
+    }
+}
+
+#endif
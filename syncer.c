@@ -0,0 +1,240 @@
+#include "syncer.h"
+#include "util.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// makes committed PUTs and APPENDs durable before they are acknowledged.
+// in SYNC_REQUEST mode every commit syncs its own file. in SYNC_GROUP mode
+// commits join a batch, and a syncer thread waits for a short window to let
+// the batch fill before syncing all of its files and their directories in
+// one pass. either way the committer is handed back through the resume
+// function once its commit is durable, so no committer holds a worker
+// while its batch fills
+
+typedef struct {
+    int fd;
+    char dir[SHARD_PREFIX]; // the working directory or a shard, "" for none
+    void *waiter;
+    bool failed;
+} syncwait_t;
+
+typedef struct {
+    syncwait_t *waits;
+    size_t size, cap;
+} batch_t;
+
+struct syncer_t {
+    syncmode_t mode;
+    useconds_t window;
+    int dirfd;
+    void (*resume)(void *waiter, bool failed);
+    batch_t filling, syncing;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t pending;
+    bool shutdown;
+};
+
+static bool batch_add(batch_t *batch, syncwait_t *wait) {
+    if (batch->size == batch->cap) {
+        size_t cap = batch->cap == 0 ? 64 : batch->cap * 2;
+        syncwait_t *waits = (syncwait_t *) realloc(batch->waits, cap * sizeof(syncwait_t));
+        if (waits == NULL) {
+            return false;
+        }
+
+        batch->waits = waits;
+        batch->cap = cap;
+    }
+
+    batch->waits[batch->size++] = *wait;
+    return true;
+}
+
+// syncs a directory whose entries a commit changed. returns 0 on success,
+// -1 on failure
+//
+static int sync_dir(syncer_t *sync, char *dir) {
+    int fd, rc;
+
+    if (strcmp(dir, ".") == 0) {
+        return fsync(sync->dirfd);
+    }
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// whether a commit of a batch before the i-th changed the same directory
+//
+static bool dir_seen(batch_t *batch, size_t i) {
+    for (size_t j = 0; j < i; j++) {
+        if (strcmp(batch->waits[j].dir, batch->waits[i].dir) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// syncs every file of a batch and every directory a commit of the batch
+// changed an entry of, each directory once, recording failures in the waits
+//
+static void batch_sync(syncer_t *sync, batch_t *batch) {
+    char *dir;
+
+    for (size_t i = 0; i < batch->size; i++) {
+        batch->waits[i].failed = fdatasync(batch->waits[i].fd) < 0;
+    }
+
+    for (size_t i = 0; i < batch->size; i++) {
+        dir = batch->waits[i].dir;
+        if (dir[0] == '\0' || dir_seen(batch, i) || sync_dir(sync, dir) == 0) {
+            continue;
+        }
+
+        for (size_t j = i; j < batch->size; j++) {
+            if (strcmp(batch->waits[j].dir, dir) == 0) {
+                batch->waits[j].failed = true;
+            }
+        }
+    }
+}
+
+static void *syncer_thread(void *sync_arg) {
+    syncer_t *sync = (syncer_t *) sync_arg;
+    batch_t batch;
+
+    pthread_mutex_lock(&sync->lock);
+    while (true) {
+        while (sync->filling.size == 0 && sync->shutdown == false) {
+            pthread_cond_wait(&sync->pending, &sync->lock);
+        }
+
+        if (sync->filling.size == 0) {
+            break;
+        }
+
+        // give the rest of the batch a moment to arrive
+        pthread_mutex_unlock(&sync->lock);
+        usleep(sync->window);
+        pthread_mutex_lock(&sync->lock);
+
+        batch = sync->filling;
+        sync->filling = sync->syncing;
+        sync->filling.size = 0;
+        pthread_mutex_unlock(&sync->lock);
+
+        batch_sync(sync, &batch);
+        for (size_t i = 0; i < batch.size; i++) {
+            sync->resume(batch.waits[i].waiter, batch.waits[i].failed);
+        }
+
+        pthread_mutex_lock(&sync->lock);
+        sync->syncing = batch;
+    }
+    pthread_mutex_unlock(&sync->lock);
+
+    return (void *) NULL;
+}
+
+// creates a syncer for the working directory. a window is only used in
+// SYNC_GROUP mode, where it is the time in microseconds a batch is given
+// to fill before it is synced
+//
+// mode  : durability mode
+// window: batching window in microseconds
+// resume: called with the waiter of every commit once it is durable, or
+//         with failed set if it could not be synced
+//
+syncer_t *syncer_create(
+    syncmode_t mode, useconds_t window, void (*resume)(void *waiter, bool failed)) {
+    syncer_t *sync = (syncer_t *) calloc(1, sizeof(syncer_t));
+    if (sync == NULL) {
+        return NULL;
+    }
+
+    sync->dirfd = open(".", O_RDONLY | O_DIRECTORY);
+    if (sync->dirfd < 0) {
+        free(sync);
+        return NULL;
+    }
+
+    sync->mode = mode;
+    sync->window = window;
+    sync->resume = resume;
+    sync->lock = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    sync->pending = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
+
+    if (mode == SYNC_GROUP && pthread_create(&sync->thread, NULL, syncer_thread, sync) != 0) {
+        close(sync->dirfd);
+        free(sync);
+        return NULL;
+    }
+
+    return sync;
+}
+
+// stops the syncer thread once the batches still pending are durable,
+// and frees the syncer
+//
+void syncer_destroy(syncer_t **sync) {
+    if (sync && *sync) {
+        if ((*sync)->mode == SYNC_GROUP) {
+            pthread_mutex_lock(&(*sync)->lock);
+            (*sync)->shutdown = true;
+            pthread_cond_signal(&(*sync)->pending);
+            pthread_mutex_unlock(&(*sync)->lock);
+            pthread_join((*sync)->thread, NULL);
+        }
+
+        pthread_mutex_destroy(&(*sync)->lock);
+        pthread_cond_destroy(&(*sync)->pending);
+        free((*sync)->filling.waits);
+        free((*sync)->syncing.waits);
+        close((*sync)->dirfd);
+        free(*sync);
+        *sync = NULL;
+    }
+}
+
+// makes a committed file durable and hands its waiter to the resume
+// function once it is. in SYNC_GROUP mode the commit joins the filling
+// batch and the waiter is resumed from the syncer thread, otherwise the
+// file is synced and the waiter resumed before returning. dir names the
+// directory if the commit created or replaced an entry in it, which then
+// has to be synced as well
+//
+// sync  : syncer
+// fd    : file descriptor of the committed file, open until resumed
+// dir   : "." or a shard directory, or "" if no entry changed
+// waiter: passed to the resume function
+//
+void syncer_commit(syncer_t *sync, int fd, char *dir, void *waiter) {
+    syncwait_t wait = { .fd = fd, .waiter = waiter, .failed = false };
+
+    snprintf(wait.dir, sizeof(wait.dir), "%s", dir);
+
+    if (sync->mode == SYNC_GROUP) {
+        pthread_mutex_lock(&sync->lock);
+        if (batch_add(&sync->filling, &wait)) {
+            pthread_cond_signal(&sync->pending);
+            pthread_mutex_unlock(&sync->lock);
+            return;
+        }
+        pthread_mutex_unlock(&sync->lock);
+    }
+
+    wait.failed = fdatasync(fd) < 0 || (wait.dir[0] != '\0' && sync_dir(sync, wait.dir) < 0);
+    sync->resume(waiter, wait.failed);
+}
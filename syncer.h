@@ -0,0 +1,19 @@
+#ifndef __SYNCER_H__
+#define __SYNCER_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+typedef enum { SYNC_NONE, SYNC_REQUEST, SYNC_GROUP } syncmode_t;
+
+typedef struct syncer_t syncer_t;
+
+syncer_t *syncer_create(
+    syncmode_t mode, useconds_t window, void (*resume)(void *waiter, bool failed));
+
+void syncer_destroy(syncer_t **sync);
+
+void syncer_commit(syncer_t *sync, int fd, char *dir, void *waiter);
+
+#endif
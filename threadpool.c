@@ -1,4 +1,5 @@
 #include "threadpool.h"
+#include "probe.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -19,6 +20,9 @@ threadpool_t *threadpool_create(int nthreads, void (*connection_func)(connection
     tpool->wqnotify = (pthread_cond_t) PTHREAD_COND_INITIALIZER;
 
     tpool->connection_func = connection_func;
+    tpool->sync_func = NULL;
+    tpool->metrics = NULL;
+    tpool->stats = NULL;
     tpool->nthreads = nthreads;
     tpool->shutdown = false;
 
@@ -74,8 +78,15 @@ bool threadpool_add_connection(threadpool_t *tpool, connection_t *conn) {
         return false;
     }
 
+    if (tpool->metrics != NULL || tpool->stats != NULL) {
+        conn->req.timing.queued = metrics_clock();
+    }
+
     pthread_mutex_lock(&tpool->wqlock);
     enqueue(tpool->wqueue, (void *) conn);
+    if (tpool->stats != NULL) {
+        stats_queued(tpool->stats, 1);
+    }
     pthread_cond_signal(&tpool->wqnotify);
     pthread_mutex_unlock(&tpool->wqlock);
     return true;
@@ -88,35 +99,80 @@ void threadpool_suspend_connection(threadpool_t *tpool, connection_t *conn) {
 
     int flags = conn->req.reqline.method == GET ? EPOLLOUT : EPOLLIN;
     conn->req.status = OK;
+    conn->req.timing.suspends++;
+    stats_count(STAT_SUSPENDS, 1);
+    PROBE2(suspend, conn->connfd, conn->req.state);
+
+    // a commit waiting to be durable is handed to the syncer, which queues
+    // it again once its batch is synced
+    if (conn->req.state == SYNC_BODY && tpool->sync_func != NULL) {
+        tpool->sync_func(conn);
+        return;
+    }
 
-    pthread_mutex_lock(&tpool->cmlock);
+    stats_lock_mutex(tpool->cmlock, STAT_MAPLOCK_WAITS);
     redblack_insert(tpool->cmap, conn->connfd, conn);
     add_connection(tpool->cpoll, conn->connfd, flags);
-    pthread_mutex_unlock(&tpool->cmlock);
+    pthread_mutex_unlock(tpool->cmlock);
+}
+
+// counts a connection a worker took off the work queue and the time it
+// waited there
+//
+static void count_dequeue(connection_t *conn) {
+    stats_count(STAT_DEQUEUES, 1);
+    stats_count(STAT_QUEUE_NS, metrics_clock() - conn->req.timing.queued);
+    if (conn->req.timing.suspends > 0) {
+        stats_count(STAT_RESUMES, 1);
+    }
 }
 
 void *free_young_thug(void *thread_pool_arg) {
     threadpool_t *tpool = (threadpool_t *) thread_pool_arg;
     connection_t *conn = NULL;
+    bool attached = false;
 
     while (true) {
         pthread_mutex_lock(&tpool->wqlock);
         while (dequeue(tpool->wqueue, (void *) &conn) == false && tpool->shutdown == false) {
             pthread_cond_wait(&tpool->wqnotify, &tpool->wqlock);
         }
+        if (tpool->stats != NULL && tpool->shutdown == false) {
+            stats_queued(tpool->stats, -1);
+        }
         pthread_mutex_unlock(&tpool->wqlock);
 
         if (tpool->shutdown == true) {
             break;
         }
 
+        // the stats are set up after the workers start, a worker takes its
+        // counters once it has work
+        if (tpool->stats != NULL) {
+            if (attached == false) {
+                stats_attach(tpool->stats);
+                attached = true;
+            }
+            count_dequeue(conn);
+        }
+
+        if (tpool->metrics != NULL) {
+            metrics_dequeued(tpool->metrics, &conn->req);
+        }
+
         tpool->connection_func(conn);
 
+        if (tpool->metrics != NULL) {
+            metrics_yield(tpool->metrics, &conn->req);
+        }
+
         if (conn->req.status == SUSPEND) {
             threadpool_suspend_connection(tpool, conn);
             continue;
         }
 
+        stats_count(STAT_REQUESTS, 1);
+        PROBE3(done, conn->connfd, conn->req.reqline.method, conn->req.status);
         connection_destroy(conn);
     }
 
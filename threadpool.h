@@ -4,6 +4,8 @@
 #include "connection.h"
 #include "queue.h"
 #include "connpoll.h"
+#include "metrics.h"
+#include "stats.h"
 #include "redblack.h"
 #include <pthread.h>
 #include <stdbool.h>
@@ -19,10 +21,13 @@ struct threadpool_t {
     map_t *cmap;
     pthread_t *pool;
     connpoll_t *cpoll;
+    metrics_t *metrics;
+    stats_t *stats;
     pthread_mutex_t wqlock;
     pthread_cond_t wqnotify;
-    pthread_mutex_t cmlock;
+    pthread_mutex_t *cmlock;
     void (*connection_func)(connection_t *);
+    void (*sync_func)(connection_t *);
     int nthreads;
     bool shutdown;
 };
@@ -0,0 +1,159 @@
+#include "binlog.h"
+#include "request.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// turns the binary request log of httpserver -f binary (see binlog.h) into
+// the text log the server writes by default, one METHOD,/OBJECT,CODE,REQ-ID
+// line per request. with -t every line also gets the time the request
+// completed at and its latency, both in microseconds
+
+static char *method_name(uint8_t method) {
+    switch (method) {
+    case GET: return "GET";
+    case PUT: return "PUT";
+    case APPEND: return "APPEND";
+    case HEAD: return "HEAD";
+    default: return NULL;
+    }
+}
+
+// binds a name record's id to the name that follows it. returns 0 on
+// success, -1 on a short read
+//
+// names : table of names by id, grown as needed
+// nnames: number of entries in the table
+//
+static int read_name(FILE *in, binlog_head_t *head, char ***names, size_t *nnames) {
+    char *name;
+
+    if (head->nameid >= *nnames) {
+        size_t n = head->nameid + 1 > 2 * *nnames ? head->nameid + 1 : 2 * *nnames;
+        char **grown = (char **) realloc(*names, n * sizeof(char *));
+        if (grown == NULL) {
+            err(EXIT_FAILURE, "realloc");
+        }
+        memset(grown + *nnames, 0, (n - *nnames) * sizeof(char *));
+        *names = grown;
+        *nnames = n;
+    }
+
+    name = (char *) malloc(head->value + 1);
+    if (name == NULL) {
+        err(EXIT_FAILURE, "malloc");
+    }
+
+    if (fread(name, 1, head->value, in) != head->value) {
+        free(name);
+        return -1;
+    }
+    name[head->value] = '\0';
+
+    free((*names)[head->nameid]);
+    (*names)[head->nameid] = name;
+    return 0;
+}
+
+// converts a whole binary log. returns the number of records that could
+// not be converted
+//
+static int convert_log(FILE *in, bool timed) {
+    char magic[BINLOG_MAGIC_LEN], **names = NULL, *name;
+    size_t nnames = 0;
+    binlog_req_t rec;
+    int bad = 0;
+
+    if (fread(magic, 1, BINLOG_MAGIC_LEN, in) != BINLOG_MAGIC_LEN
+        || memcmp(magic, BINLOG_MAGIC, BINLOG_MAGIC_LEN) != 0) {
+        errx(EXIT_FAILURE, "not a binary request log");
+    }
+
+    while (fread(&rec.head, sizeof(rec.head), 1, in) == 1) {
+        if (rec.head.kind == BINLOG_NAME) {
+            if (read_name(in, &rec.head, &names, &nnames) < 0) {
+                warnx("truncated name record");
+                bad++;
+                break;
+            }
+            continue;
+        }
+
+        if (rec.head.kind != BINLOG_REQUEST) {
+            warnx("bad record kind %d", rec.head.kind);
+            bad++;
+            break;
+        }
+
+        if (fread((char *) &rec + sizeof(rec.head), sizeof(rec) - sizeof(rec.head), 1, in) != 1) {
+            warnx("truncated request record");
+            bad++;
+            break;
+        }
+
+        // the server logs a request it rejected before parsing its object
+        // with the null name
+        name = "(null)";
+        if (rec.head.nameid != BINLOG_NONAME) {
+            name = rec.head.nameid < nnames ? names[rec.head.nameid] : NULL;
+        }
+
+        if (method_name(rec.head.method) == NULL || name == NULL) {
+            bad++;
+            continue;
+        }
+
+        printf("%s,/%s,%d,%" PRIu32, method_name(rec.head.method), name, rec.head.value,
+            rec.reqid);
+        if (timed) {
+            printf(",%" PRIu64 ",%" PRIu32, rec.time, rec.latency);
+        }
+        putchar('\n');
+    }
+
+    for (size_t i = 0; i < nnames; i++) {
+        free(names[i]);
+    }
+    free(names);
+    return bad;
+}
+
+static void usage(char *exec) {
+    fprintf(stderr, "usage: %s [-t] [binlog]\n", exec);
+}
+
+int main(int argc, char *argv[]) {
+    bool timed = false;
+    FILE *in = stdin;
+    int opt, bad;
+
+    while ((opt = getopt(argc, argv, "t")) != -1) {
+        switch (opt) {
+        case 't': timed = true; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (optind < argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (optind == argc - 1) {
+        in = fopen(argv[optind], "r");
+        if (in == NULL) {
+            err(EXIT_FAILURE, "cannot open %s", argv[optind]);
+        }
+    }
+
+    bad = convert_log(in, timed);
+    fclose(in);
+    if (bad > 0) {
+        errx(EXIT_FAILURE, "%d records could not be converted", bad);
+    }
+
+    return EXIT_SUCCESS;
+}
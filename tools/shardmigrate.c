@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+
+#include "util.h"
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// moves the objects of a data directory between the flat layout and the
+// hashed layout of httpserver -H (see shard_path()). run it while the
+// server is stopped. objects are moved with rename(2), so an interrupted
+// migration leaves every object whole in one layout or the other and can
+// simply be run again
+
+// checks that a file name is an object name a request line can name
+//
+static bool is_object_name(char *name) {
+    if (strlen(name) > NAME_MAX) {
+        return false;
+    }
+
+    for (; *name != '\0'; name++) {
+        if (strchr("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._", *name)
+            == NULL) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool is_shard_name(char *name) {
+    return strlen(name) == 2 && strchr("0123456789abcdef", name[0]) != NULL
+           && strchr("0123456789abcdef", name[1]) != NULL;
+}
+
+// moves a file without replacing one that is already there. returns 0 on
+// success, -1 on failure
+//
+static int move_file(char *from, char *to) {
+    if (renameat2(AT_FDCWD, from, AT_FDCWD, to, RENAME_NOREPLACE) < 0) {
+        warn("cannot move %s to %s", from, to);
+        return -1;
+    }
+
+    return 0;
+}
+
+// moves every regular file in the directory that is an object into its
+// shard. returns the number of files that could not be moved
+//
+static int shard_objects(void) {
+    char path[SHARD_PATHSIZE], dir[SHARD_PREFIX];
+    struct dirent *de;
+    struct stat statbuf;
+    int moved = 0, failed = 0;
+    DIR *d = opendir(".");
+
+    if (d == NULL) {
+        err(EXIT_FAILURE, "cannot list directory");
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        if (is_object_name(de->d_name) == false || lstat(de->d_name, &statbuf) < 0
+            || S_ISREG(statbuf.st_mode) == 0) {
+            continue;
+        }
+
+        shard_path(de->d_name, path);
+        snprintf(dir, sizeof dir, "%.2s", path);
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+            err(EXIT_FAILURE, "cannot create %s", dir);
+        }
+
+        snprintf(dir, sizeof dir, "%.5s", path);
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+            err(EXIT_FAILURE, "cannot create %s", dir);
+        }
+
+        if (move_file(de->d_name, path) < 0) {
+            failed++;
+        } else {
+            moved++;
+        }
+    }
+
+    closedir(d);
+    printf("moved %d objects into shards\n", moved);
+    return failed;
+}
+
+// moves every object out of the shards back into the directory and
+// removes the shards that are left empty. returns the number of files
+// that could not be moved
+//
+static int unshard_objects(void) {
+    char mid[SHARD_PREFIX], path[SHARD_PATHSIZE];
+    struct dirent *top, *sub, *de;
+    int moved = 0, failed = 0;
+    DIR *d = opendir("."), *m, *s;
+
+    if (d == NULL) {
+        err(EXIT_FAILURE, "cannot list directory");
+    }
+
+    while ((top = readdir(d)) != NULL) {
+        if (is_shard_name(top->d_name) == false || (m = opendir(top->d_name)) == NULL) {
+            continue;
+        }
+
+        while ((sub = readdir(m)) != NULL) {
+            if (is_shard_name(sub->d_name) == false) {
+                continue;
+            }
+
+            snprintf(mid, sizeof mid, "%.2s/%.2s", top->d_name, sub->d_name);
+            if ((s = opendir(mid)) == NULL) {
+                continue;
+            }
+
+            while ((de = readdir(s)) != NULL) {
+                if (is_object_name(de->d_name) == false || strcmp(de->d_name, ".") == 0
+                    || strcmp(de->d_name, "..") == 0) {
+                    continue;
+                }
+
+                snprintf(path, sizeof path, "%s/%s", mid, de->d_name);
+                if (move_file(path, de->d_name) < 0) {
+                    failed++;
+                } else {
+                    moved++;
+                }
+            }
+
+            closedir(s);
+            rmdir(mid);
+        }
+
+        closedir(m);
+        rmdir(top->d_name);
+    }
+
+    closedir(d);
+    printf("moved %d objects out of shards\n", moved);
+    return failed;
+}
+
+static void usage(char *exec) {
+    fprintf(stderr, "usage: %s [-r] <datadir>\n", exec);
+}
+
+int main(int argc, char *argv[]) {
+    bool reverse = false;
+    int opt, failed;
+
+    while ((opt = getopt(argc, argv, "r")) != -1) {
+        switch (opt) {
+        case 'r': reverse = true; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (chdir(argv[optind]) < 0) {
+        err(EXIT_FAILURE, "cannot enter %s", argv[optind]);
+    }
+
+    failed = reverse ? unshard_objects() : shard_objects();
+    if (failed > 0) {
+        errx(EXIT_FAILURE, "%d objects were not moved", failed);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,197 @@
+#include "stats.h"
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// prints the runtime counters of a running httpserver -S from its shared
+// memory stats segment, without going near the server's sockets. with -i
+// the counters are printed again every interval as rates per second, with
+// -t every thread's counters are printed next to the totals
+
+static const char *stat_names[NSTATS] = {
+    [STAT_ACCEPTS] = "accepts",
+    [STAT_WAKEUPS] = "epoll_wakeups",
+    [STAT_EVENTS] = "epoll_events",
+    [STAT_REQUESTS] = "requests",
+    [STAT_SUSPENDS] = "suspends",
+    [STAT_RESUMES] = "resumes",
+    [STAT_RECVS] = "recvs",
+    [STAT_BYTES_IN] = "bytes_in",
+    [STAT_SENDS] = "sends",
+    [STAT_BYTES_OUT] = "bytes_out",
+    [STAT_DEQUEUES] = "dequeues",
+    [STAT_QUEUE_NS] = "queue_ns",
+    [STAT_LOCK_WAITS] = "lock_waits",
+    [STAT_LOCK_NS] = "lock_wait_ns",
+    [STAT_MAPLOCK_WAITS] = "maplock_waits",
+    [STAT_MAPLOCK_NS] = "maplock_wait_ns",
+    [STAT_TMPFILES] = "tmpfiles",
+};
+
+// maps the stats segment of the server on a port read-only
+//
+static statseg_t *map_segment(uint16_t port) {
+    char name[STATS_NAMELEN];
+    struct stat statbuf;
+    statseg_t *seg;
+    int fd;
+
+    stats_name(port, name);
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        err(EXIT_FAILURE, "no stats segment %s", name);
+    }
+
+    if (fstat(fd, &statbuf) < 0 || (size_t) statbuf.st_size < sizeof(statseg_t)) {
+        errx(EXIT_FAILURE, "stats segment %s is not ready", name);
+    }
+
+    seg = (statseg_t *) mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        err(EXIT_FAILURE, "mmap");
+    }
+
+    if (seg->magic != STATS_MAGIC || seg->version != STATS_VERSION || seg->nstats != NSTATS
+        || sizeof(statseg_t) + seg->nblocks * sizeof(statblock_t) > (size_t) statbuf.st_size) {
+        errx(EXIT_FAILURE, "stats segment %s is not one this tool can read", name);
+    }
+
+    return seg;
+}
+
+// copies every counter of every block, totals first
+//
+// counts: (nblocks + 1) * NSTATS counters to fill
+//
+static void snapshot(statseg_t *seg, uint64_t *counts) {
+    memset(counts, 0, NSTATS * sizeof(uint64_t));
+    for (uint32_t b = 0; b < seg->nblocks; b++) {
+        for (int s = 0; s < NSTATS; s++) {
+            uint64_t n = atomic_load_explicit(&seg->blocks[b].counts[s], memory_order_relaxed);
+            counts[(b + 1) * NSTATS + s] = n;
+            counts[s] += n;
+        }
+    }
+}
+
+static double ratio(uint64_t num, uint64_t den) {
+    return den == 0 ? 0.0 : (double) num / den;
+}
+
+// prints the counters, or their rates since the last snapshot
+//
+// now    : current snapshot
+// last   : previous snapshot, or NULL for totals
+// seconds: time between the snapshots
+// threads: whether to print the counters of every thread
+//
+static void print_counts(
+    statseg_t *seg, uint64_t *now, uint64_t *last, double seconds, bool threads) {
+    uint32_t ncols = threads ? seg->nblocks + 1 : 1;
+    uint64_t d[NSTATS];
+
+    printf("%-16s", last == NULL ? "counter" : "counter/s");
+    // the main thread takes the first block, the workers the rest
+    for (uint32_t c = 0; c < ncols; c++) {
+        char label[24];
+
+        if (c < 2) {
+            snprintf(label, sizeof(label), "%s", c == 0 ? "total" : "main");
+        } else {
+            snprintf(label, sizeof(label), "worker%u", c - 1);
+        }
+        printf(" %14s", label);
+    }
+    putchar('\n');
+
+    for (int s = 0; s < NSTATS; s++) {
+        printf("%-16s", stat_names[s]);
+        for (uint32_t c = 0; c < ncols; c++) {
+            uint64_t v = now[c * NSTATS + s] - (last != NULL ? last[c * NSTATS + s] : 0);
+            if (last != NULL) {
+                printf(" %14.1f", v / seconds);
+            } else {
+                printf(" %14" PRIu64, v);
+            }
+        }
+        putchar('\n');
+    }
+
+    for (int s = 0; s < NSTATS; s++) {
+        d[s] = now[s] - (last != NULL ? last[s] : 0);
+    }
+
+    printf("queued now       %14" PRId64 "\n", atomic_load(&seg->queued));
+    printf("suspends/request %14.2f\n", ratio(d[STAT_SUSPENDS], d[STAT_REQUESTS]));
+    printf("events/wakeup    %14.2f\n", ratio(d[STAT_EVENTS], d[STAT_WAKEUPS]));
+    printf("queue wait us    %14.2f\n", ratio(d[STAT_QUEUE_NS], d[STAT_DEQUEUES]) / 1000);
+    printf("lock wait us     %14.2f\n", ratio(d[STAT_LOCK_NS], d[STAT_LOCK_WAITS]) / 1000);
+    printf("maplock wait us  %14.2f\n", ratio(d[STAT_MAPLOCK_NS], d[STAT_MAPLOCK_WAITS]) / 1000);
+}
+
+static void usage(char *exec) {
+    fprintf(stderr, "usage: %s [-t] [-i seconds] <port>\n", exec);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t *now, *last;
+    bool threads = false;
+    int opt, interval = 0;
+    statseg_t *seg;
+    size_t ncounts;
+    long port;
+
+    while ((opt = getopt(argc, argv, "ti:")) != -1) {
+        switch (opt) {
+        case 't': threads = true; break;
+        case 'i':
+            interval = atoi(optarg);
+            if (interval <= 0) {
+                errx(EXIT_FAILURE, "bad interval: %s", optarg);
+            }
+            break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    port = strtol(argv[optind], NULL, 10);
+    if (port <= 0 || port > UINT16_MAX) {
+        errx(EXIT_FAILURE, "bad port: %s", argv[optind]);
+    }
+
+    seg = map_segment(port);
+    ncounts = (seg->nblocks + 1) * NSTATS;
+    now = (uint64_t *) calloc(ncounts, sizeof(uint64_t));
+    last = (uint64_t *) calloc(ncounts, sizeof(uint64_t));
+    if (now == NULL || last == NULL) {
+        err(EXIT_FAILURE, "calloc");
+    }
+
+    snapshot(seg, now);
+    print_counts(seg, now, NULL, 0, threads);
+
+    while (interval > 0) {
+        memcpy(last, now, ncounts * sizeof(uint64_t));
+        sleep(interval);
+        snapshot(seg, now);
+        putchar('\n');
+        print_counts(seg, now, last, interval, threads);
+        fflush(stdout);
+    }
+
+    free(now);
+    free(last);
+    return EXIT_SUCCESS;
+}
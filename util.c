@@ -1,4 +1,5 @@
 #include "util.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -70,3 +71,34 @@ void strlower(char str[]) {
 bool strcontains(char *str, char *sequence) {
     return strstr(str, sequence) != NULL;
 }
+
+// hashes a string with 64 bit FNV-1a, used to pick buckets and slots
+// for object names
+//
+// str: input string
+//
+uint64_t strhash(char *str) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (; *str != '\0'; str++) {
+        hash ^= (uint8_t) *str;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// writes the sharded path of an object, which puts it in one of 65536
+// directories two levels deep picked by the top bytes of its hash
+// (ab/cd/name) so that no directory holds more than a sliver of a large
+// namespace
+//
+// name: object name, at most NAME_MAX bytes
+// path: buffer for the path, at least SHARD_PATHSIZE bytes
+//
+void shard_path(char *name, char *path) {
+    uint64_t hash = strhash(name);
+
+    snprintf(path, SHARD_PATHSIZE, "%02x/%02x/%s", (unsigned) (hash >> 56),
+        (unsigned) ((hash >> 48) & 0xff), name);
+}
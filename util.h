@@ -3,9 +3,15 @@
 
 #include <stdbool.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #define BLOCK 4096
 
+// room for the sharded path of an object: two levels of two hex digits
+// and the object name
+#define SHARD_PREFIX   6
+#define SHARD_PATHSIZE (SHARD_PREFIX + NAME_MAX + 1)
+
 uint16_t strtouint16(char num[]);
 
 uint32_t strtouint32(char num[]);
@@ -16,4 +22,8 @@ void strlower(char str[]);
 
 bool strcontains(char *str, char *sequence);
 
+uint64_t strhash(char *str);
+
+void shard_path(char *name, char *path);
+
 #endif